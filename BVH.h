@@ -0,0 +1,388 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <Bounds.h>
+#include <Frustum.h>
+#include <Trace.h>
+
+#include <vector>
+#include <cstdint>
+#include <cfloat>
+#include <algorithm>
+#include <iostream>
+
+// Primitives a leaf holds before the build considers splitting it.
+const uint32_t BVH_LEAF_SIZE = 4;
+// Centroid bins per axis the SAH split is evaluated at.
+const int BVH_BINS = 16;
+// Cost of visiting a node relative to testing one primitive, for the SAH.
+const float BVH_TRAVERSAL_COST = 1.0f;
+// Traversal uses a fixed stack, the build makes a leaf of anything deeper.
+const int BVH_MAX_DEPTH = 64;
+
+// Leaves have count > 0 and own indices[first, first + count). Interior nodes have count == 0 and their
+// children at first and first + 1. Children always come after their parent in the array.
+struct BVHNode {
+    AABB bounds;
+    uint32_t first;
+    uint32_t count;
+
+    bool is_leaf() const { return count > 0; }
+};
+
+struct BVHStats {
+    size_t nodes = 0;
+    size_t leaves = 0;
+    int depth = 0;
+    // Surface area heuristic cost of the tree relative to its root, lower is better.
+    float sah_cost = 0.0f;
+};
+
+// Bounding volume hierarchy over primitive boxes, e.g. the world bounds of model instances. build()
+// splits by the surface area heuristic over binned centroids, which suits static content; refit()
+// recomputes the boxes bottom-up for primitives that moved, keeping the tree shape. Queries report
+// primitives by their index in the boxes passed to build().
+class BVH {
+public:
+    void build(const std::vector<AABB>& boxes);
+    // boxes must hold as many primitives as the tree was built with. The tree degrades as things move
+    // away from where they were built, rebuild now and then.
+    void refit(const std::vector<AABB>& boxes);
+
+    // Calls visit(primitive) for every primitive whose box is at least partly inside the frustum.
+    // Primitives under a node that is fully inside are reported without testing their boxes.
+    template<typename Visit>
+    void query_frustum(const Frustum& frustum, Visit visit) const;
+    // Calls visit(primitive) for every primitive whose box overlaps box.
+    template<typename Visit>
+    void query_overlap(const AABB& box, Visit visit) const;
+    // Nearest primitive hit by the ray, -1 for none. hit(primitive, distance) refines a hit on the box,
+    // e.g. against the actual triangles: it returns false for a miss or lowers distance to the exact hit.
+    // distance is the maximum on the way in and the hit distance on the way out.
+    template<typename Hit>
+    int raycast(const glm::vec3& origin, const glm::vec3& direction, float& distance, Hit hit) const;
+    // Nearest primitive box hit by the ray.
+    int raycast(const glm::vec3& origin, const glm::vec3& direction, float& distance) const;
+
+    bool empty() const { return nodes.empty(); }
+    size_t size() const { return boxes.size(); }
+    const std::vector<BVHNode>& get_nodes() const { return nodes; }
+    BVHStats stats() const;
+private:
+    std::vector<BVHNode> nodes;
+    std::vector<uint32_t> indices;
+    // Copy of the primitive boxes, leaves test them one by one.
+    std::vector<AABB> boxes;
+
+    void build_node(uint32_t node, const std::vector<glm::vec3>& centroids, int depth);
+};
+
+namespace bvh {
+    float surface_area(const AABB& box) {
+        if (box.is_empty()) {
+            return 0.0f;
+        }
+        glm::vec3 d = box.max - box.min;
+        return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+    }
+
+    bool overlaps(const AABB& a, const AABB& b) {
+        return a.min.x <= b.max.x && a.max.x >= b.min.x && a.min.y <= b.max.y && a.max.y >= b.min.y &&
+            a.min.z <= b.max.z && a.max.z >= b.min.z;
+    }
+
+    // Slab test. inv_direction is 1 / direction per axis, infinities included. On a hit, entry is where
+    // the ray enters the box, 0 if it starts inside.
+    bool ray_box(const glm::vec3& origin, const glm::vec3& inv_direction, const AABB& box, float max_distance,
+        float& entry) {
+        glm::vec3 t0 = (box.min - origin) * inv_direction;
+        glm::vec3 t1 = (box.max - origin) * inv_direction;
+        glm::vec3 near = glm::min(t0, t1);
+        glm::vec3 far = glm::max(t0, t1);
+        float t_near = std::max(std::max(near.x, near.y), std::max(near.z, 0.0f));
+        float t_far = std::min(std::min(far.x, far.y), std::min(far.z, max_distance));
+        entry = t_near;
+        return t_near <= t_far;
+    }
+
+    struct Bin {
+        AABB bounds;
+        uint32_t count = 0;
+    };
+}
+
+void BVH::build(const std::vector<AABB>& boxes) {
+    TRACE_SCOPE("BVH::build");
+    nodes.clear();
+    indices.resize(boxes.size());
+    this->boxes = boxes;
+    if (boxes.empty()) {
+        return;
+    }
+    std::vector<glm::vec3> centroids(boxes.size());
+    for (uint32_t i = 0; i < boxes.size(); i++) {
+        indices[i] = i;
+        centroids[i] = boxes[i].center();
+    }
+    // A binary tree with at least one primitive per leaf has under 2n nodes.
+    nodes.reserve(boxes.size() * 2);
+    nodes.push_back({ AABB(), 0, (uint32_t)boxes.size() });
+    build_node(0, centroids, 1);
+}
+
+void BVH::build_node(uint32_t node, const std::vector<glm::vec3>& centroids, int depth) {
+    uint32_t first = nodes[node].first;
+    uint32_t count = nodes[node].count;
+    AABB bounds, centroid_bounds;
+    for (uint32_t i = first; i < first + count; i++) {
+        bounds.expand(boxes[indices[i]]);
+        centroid_bounds.expand(centroids[indices[i]]);
+    }
+    nodes[node].bounds = bounds;
+    if (count <= BVH_LEAF_SIZE || depth >= BVH_MAX_DEPTH) {
+        return;
+    }
+
+    // Cheapest split over all axes: area times primitive count on each side, per the SAH.
+    float best_cost = FLT_MAX;
+    int best_axis = -1, best_split = 0;
+    glm::vec3 extent = centroid_bounds.max - centroid_bounds.min;
+    for (int axis = 0; axis < 3; axis++) {
+        if (extent[axis] <= 0.0f) {
+            continue;
+        }
+        float scale = BVH_BINS / extent[axis];
+        bvh::Bin bins[BVH_BINS];
+        for (uint32_t i = first; i < first + count; i++) {
+            int bin = std::min(BVH_BINS - 1, (int)((centroids[indices[i]][axis] - centroid_bounds.min[axis]) * scale));
+            bins[bin].count++;
+            bins[bin].bounds.expand(boxes[indices[i]]);
+        }
+        // Sweep from the right to get the cost of each right side, then from the left.
+        float right_area[BVH_BINS - 1];
+        uint32_t right_count[BVH_BINS - 1];
+        AABB right;
+        uint32_t count_right = 0;
+        for (int split = BVH_BINS - 1; split > 0; split--) {
+            right.expand(bins[split].bounds);
+            count_right += bins[split].count;
+            right_area[split - 1] = bvh::surface_area(right);
+            right_count[split - 1] = count_right;
+        }
+        AABB left;
+        uint32_t count_left = 0;
+        for (int split = 1; split < BVH_BINS; split++) {
+            left.expand(bins[split - 1].bounds);
+            count_left += bins[split - 1].count;
+            if (count_left == 0 || right_count[split - 1] == 0) {
+                continue;
+            }
+            float cost = bvh::surface_area(left) * count_left + right_area[split - 1] * right_count[split - 1];
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_axis = axis;
+                best_split = split;
+            }
+        }
+    }
+
+    uint32_t middle;
+    if (best_axis < 0) {
+        // Every centroid in the same spot, halve the list so the leaves stay small.
+        middle = first + count / 2;
+    }
+    else {
+        float area = bvh::surface_area(bounds);
+        if (area > 0.0f && BVH_TRAVERSAL_COST + best_cost / area >= (float)count) {
+            // Splitting costs more than testing all of them.
+            return;
+        }
+        float scale = BVH_BINS / extent[best_axis];
+        float origin = centroid_bounds.min[best_axis];
+        uint32_t* split = std::partition(indices.data() + first, indices.data() + first + count,
+            [&](uint32_t i) {
+                return std::min(BVH_BINS - 1, (int)((centroids[i][best_axis] - origin) * scale)) < best_split;
+            });
+        middle = (uint32_t)(split - indices.data());
+    }
+
+    uint32_t left_child = (uint32_t)nodes.size();
+    nodes.push_back({ AABB(), first, middle - first });
+    nodes.push_back({ AABB(), middle, first + count - middle });
+    nodes[node].first = left_child;
+    nodes[node].count = 0;
+    build_node(left_child, centroids, depth + 1);
+    build_node(left_child + 1, centroids, depth + 1);
+}
+
+void BVH::refit(const std::vector<AABB>& boxes) {
+    TRACE_SCOPE("BVH::refit");
+    if (boxes.size() != this->boxes.size()) {
+        std::cout << "ERROR::BVH::REFIT_SIZE_MISMATCH " << boxes.size() << " != " << this->boxes.size() << std::endl;
+        return;
+    }
+    this->boxes = boxes;
+    for (size_t n = nodes.size(); n-- > 0;) {
+        BVHNode& node = nodes[n];
+        AABB bounds;
+        if (node.is_leaf()) {
+            for (uint32_t i = node.first; i < node.first + node.count; i++) {
+                bounds.expand(boxes[indices[i]]);
+            }
+        }
+        else {
+            bounds = nodes[node.first].bounds;
+            bounds.expand(nodes[node.first + 1].bounds);
+        }
+        node.bounds = bounds;
+    }
+}
+
+template<typename Visit>
+void BVH::query_frustum(const Frustum& frustum, Visit visit) const {
+    if (nodes.empty()) {
+        return;
+    }
+    // Node and whether it is known to be fully inside, then nothing below it needs testing.
+    uint32_t stack[BVH_MAX_DEPTH * 2];
+    bool inside_stack[BVH_MAX_DEPTH * 2];
+    int top = 0;
+    stack[top] = 0;
+    inside_stack[top++] = false;
+    while (top > 0) {
+        top--;
+        const BVHNode& node = nodes[stack[top]];
+        bool inside = inside_stack[top];
+        if (!inside) {
+            if (!frustum.intersects(node.bounds)) {
+                continue;
+            }
+            inside = frustum.contains(node.bounds);
+        }
+        if (node.is_leaf()) {
+            for (uint32_t i = node.first; i < node.first + node.count; i++) {
+                if (inside || frustum.intersects(boxes[indices[i]])) {
+                    visit(indices[i]);
+                }
+            }
+            continue;
+        }
+        stack[top] = node.first + 1;
+        inside_stack[top++] = inside;
+        stack[top] = node.first;
+        inside_stack[top++] = inside;
+    }
+}
+
+template<typename Visit>
+void BVH::query_overlap(const AABB& box, Visit visit) const {
+    if (nodes.empty()) {
+        return;
+    }
+    uint32_t stack[BVH_MAX_DEPTH * 2];
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+        const BVHNode& node = nodes[stack[--top]];
+        if (!bvh::overlaps(node.bounds, box)) {
+            continue;
+        }
+        if (node.is_leaf()) {
+            for (uint32_t i = node.first; i < node.first + node.count; i++) {
+                if (bvh::overlaps(boxes[indices[i]], box)) {
+                    visit(indices[i]);
+                }
+            }
+            continue;
+        }
+        stack[top++] = node.first + 1;
+        stack[top++] = node.first;
+    }
+}
+
+template<typename Hit>
+int BVH::raycast(const glm::vec3& origin, const glm::vec3& direction, float& distance, Hit hit) const {
+    if (nodes.empty()) {
+        return -1;
+    }
+    glm::vec3 inv_direction = 1.0f / direction;
+    int nearest = -1;
+    float entry;
+    uint32_t stack[BVH_MAX_DEPTH * 2];
+    int top = 0;
+    if (bvh::ray_box(origin, inv_direction, nodes[0].bounds, distance, entry)) {
+        stack[top++] = 0;
+    }
+    while (top > 0) {
+        const BVHNode& node = nodes[stack[--top]];
+        // The box may be further than a hit found since it was pushed.
+        if (!bvh::ray_box(origin, inv_direction, node.bounds, distance, entry)) {
+            continue;
+        }
+        if (node.is_leaf()) {
+            for (uint32_t i = node.first; i < node.first + node.count; i++) {
+                float t = distance;
+                if (hit(indices[i], t) && t <= distance) {
+                    distance = t;
+                    nearest = (int)indices[i];
+                }
+            }
+            continue;
+        }
+        // Nearer child on top, so its hits can prune the other.
+        uint32_t left = node.first, right = node.first + 1;
+        float left_entry, right_entry;
+        bool left_hit = bvh::ray_box(origin, inv_direction, nodes[left].bounds, distance, left_entry);
+        bool right_hit = bvh::ray_box(origin, inv_direction, nodes[right].bounds, distance, right_entry);
+        if (left_hit && right_hit) {
+            bool right_first = right_entry < left_entry;
+            stack[top++] = right_first ? left : right;
+            stack[top++] = right_first ? right : left;
+        }
+        else if (left_hit) {
+            stack[top++] = left;
+        }
+        else if (right_hit) {
+            stack[top++] = right;
+        }
+    }
+    return nearest;
+}
+
+int BVH::raycast(const glm::vec3& origin, const glm::vec3& direction, float& distance) const {
+    glm::vec3 inv_direction = 1.0f / direction;
+    return raycast(origin, direction, distance, [&](uint32_t primitive, float& t) {
+        float entry;
+        if (!bvh::ray_box(origin, inv_direction, boxes[primitive], t, entry)) {
+            return false;
+        }
+        t = entry;
+        return true;
+    });
+}
+
+BVHStats BVH::stats() const {
+    BVHStats stats;
+    stats.nodes = nodes.size();
+    if (nodes.empty()) {
+        return stats;
+    }
+    float root_area = bvh::surface_area(nodes[0].bounds);
+    std::vector<int> depth(nodes.size(), 1);
+    for (size_t n = 0; n < nodes.size(); n++) {
+        const BVHNode& node = nodes[n];
+        stats.depth = std::max(stats.depth, depth[n]);
+        float area = root_area > 0.0f ? bvh::surface_area(node.bounds) / root_area : 0.0f;
+        if (node.is_leaf()) {
+            stats.leaves++;
+            stats.sah_cost += area * node.count;
+        }
+        else {
+            stats.sah_cost += area;
+            depth[node.first] = depth[n] + 1;
+            depth[node.first + 1] = depth[n] + 1;
+        }
+    }
+    return stats;
+}
@@ -0,0 +1,878 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#include <glm/glm.hpp>
+
+#include <ObjLoader.h>
+#include <Model.h>
+#include <Renderer.h>
+#include <BVH.h>
+#include <OcclusionBuffer.h>
+
+#include <vector>
+#include <string>
+#include <chrono>
+#include <thread>
+#include <random>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+
+// Command line benchmarks, see main.cpp for the flags that select them.
+
+int bench_obj_loader(const std::vector<std::string>& paths, int iterations);
+int bench_obj_scaling(const std::vector<std::string>& paths, int iterations);
+int bench_mesh_cache(const std::vector<std::string>& paths);
+int bench_model_import(const std::vector<std::string>& paths, int copies);
+int bench_upload(const std::string& path, int frames);
+int bench_draw(const std::string& path, int frames, int copies);
+int bench_instancing(const std::string& path, int frames);
+int bench_uniforms(int iterations);
+int bench_program_cache();
+int bench_shader_compile();
+int bench_trace(int iterations);
+int bench_culling(size_t boxes, int iterations);
+int bench_bvh(size_t instances, int queries);
+int bench_occlusion(size_t occludees, int frames);
+
+namespace bench {
+    struct BenchVertex {
+        glm::vec3 Position;
+        glm::vec3 Normal;
+        glm::vec2 TexCoords;
+    };
+
+    double now_seconds() {
+        using clock = std::chrono::steady_clock;
+        return std::chrono::duration<double>(clock::now().time_since_epoch()).count();
+    }
+
+    // Hidden window whose context the GL benchmarks run in.
+    GLFWwindow* create_context() {
+        if (!glfwInit()) {
+            std::cout << "ERROR::GLFW::INITIALIZATION_FAILED" << std::endl;
+            return nullptr;
+        }
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 4);
+        glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+        GLFWwindow* window = glfwCreateWindow(64, 64, "bench", nullptr, nullptr);
+        if (window == nullptr) {
+            std::cout << "ERROR::GLFW::FAILED_TO_CREATE_WINDOW" << std::endl;
+            glfwTerminate();
+            return nullptr;
+        }
+        glfwMakeContextCurrent(window);
+        if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
+            std::cout << "ERROR::GLAD::FAILED_TO_INITIALISE" << std::endl;
+            glfwDestroyWindow(window);
+            glfwTerminate();
+            return nullptr;
+        }
+        // Every benchmark gets a fresh context, nothing the state cache remembers is bound in it.
+        GLState::instance().invalidate();
+        return window;
+    }
+
+    void destroy_context(GLFWwindow* window) {
+        glfwDestroyWindow(window);
+        glfwTerminate();
+    }
+
+    // Appends the twelve triangles of box to mesh.
+    void add_box(const AABB& box, OccluderMesh& mesh) {
+        unsigned int first = (unsigned int)mesh.positions.size();
+        for (int i = 0; i < 8; i++) {
+            mesh.positions.push_back(glm::vec3((i & 1) ? box.max.x : box.min.x, (i & 2) ? box.max.y : box.min.y,
+                (i & 4) ? box.max.z : box.min.z));
+        }
+        const unsigned int faces[36] = { 0, 1, 3, 0, 3, 2, 4, 6, 7, 4, 7, 5, 0, 4, 5, 0, 5, 1,
+            2, 3, 7, 2, 7, 6, 0, 2, 6, 0, 6, 4, 1, 5, 7, 1, 7, 3 };
+        for (unsigned int index : faces) {
+            mesh.indices.push_back(first + index);
+        }
+    }
+
+    size_t file_size(const std::string& path) {
+        std::ifstream file(path, std::ifstream::binary | std::ifstream::ate);
+        return file ? (size_t)file.tellg() : 0;
+    }
+
+    // The getline/stringstream loader Mesh::load_from_obj used before ObjLoader.h, kept as the baseline.
+    size_t legacy_load_obj(const std::string& path, std::vector<BenchVertex>& vertices) {
+        std::ifstream mesh_file(path);
+        std::vector<glm::vec3> pos, normal;
+        std::vector<glm::vec2> tex;
+        while (!mesh_file.eof()) {
+            char junk;
+            char line[128];
+            std::stringstream s;
+            mesh_file.getline(line, 128);
+            if (mesh_file.fail() && !mesh_file.eof()) {
+                mesh_file.clear();
+            }
+            s << line;
+            float x, y, z;
+            if (line[0] == 'v') {
+                if (line[1] == 'n') {
+                    s >> junk >> junk >> x >> y >> z;
+                    normal.push_back(glm::vec3(x, y, z));
+                }
+                else if (line[1] == 't') {
+                    s >> junk >> junk >> x >> y;
+                    tex.push_back(glm::vec2(x, y));
+                }
+                else {
+                    s >> junk >> x >> y >> z;
+                    pos.push_back(glm::vec3(x, y, z));
+                }
+            }
+            if (line[0] == 'f') {
+                BenchVertex v;
+                s >> junk;
+                for (int i = 0; i < 3; i++) {
+                    s >> x >> junk >> y >> junk >> z;
+                    v.Position = pos[(size_t)x - 1];
+                    v.TexCoords = tex[(size_t)y - 1];
+                    v.Normal = normal[(size_t)z - 1];
+                    vertices.push_back(v);
+                }
+            }
+        }
+        return pos.size();
+    }
+
+    size_t mapped_load_obj(const std::string& path, std::vector<BenchVertex>& vertices) {
+        ObjData obj;
+        if (!load_obj(path, obj)) {
+            return 0;
+        }
+        vertices.reserve(obj.corners.size());
+        for (const ObjIndex& c : obj.corners) {
+            BenchVertex v;
+            v.Position = obj.positions[c.position];
+            v.TexCoords = c.texcoord >= 0 ? obj.texcoords[c.texcoord] : glm::vec2(0.0f);
+            v.Normal = c.normal >= 0 ? obj.normals[c.normal] : glm::vec3(0.0f);
+            vertices.push_back(v);
+        }
+        return obj.positions.size();
+    }
+
+    bool same_obj(const ObjData& a, const ObjData& b) {
+        return a.positions == b.positions && a.texcoords == b.texcoords && a.normals == b.normals &&
+            a.corners.size() == b.corners.size() &&
+            std::memcmp(a.corners.data(), b.corners.data(), a.corners.size() * sizeof(ObjIndex)) == 0;
+    }
+
+    template<typename F>
+    void report_throughput(const char* name, size_t bytes, int iterations, F load) {
+        size_t positions = 0, corners = 0;
+        double start = now_seconds();
+        for (int i = 0; i < iterations; i++) {
+            std::vector<BenchVertex> vertices;
+            positions = load(vertices);
+            corners = vertices.size();
+        }
+        double elapsed = (now_seconds() - start) / iterations;
+        std::cout << "  " << name << ": " << elapsed * 1000.0 << " ms, "
+            << bytes / elapsed / (1024.0 * 1024.0) << " MB/s, "
+            << positions / elapsed << " vertices/s (" << positions << " v, "
+            << corners << " face corners)" << std::endl;
+    }
+}
+
+int bench_obj_loader(const std::vector<std::string>& paths, int iterations) {
+    for (const std::string& path : paths) {
+        size_t bytes = bench::file_size(path);
+        if (bytes == 0) {
+            std::cout << "ERROR::BENCH::FILE_NOT_FOUND " << path << std::endl;
+            continue;
+        }
+        std::cout << path << " (" << bytes / 1024 << " KB, " << iterations << " iterations)" << std::endl;
+        bench::report_throughput("legacy", bytes, iterations, [&](std::vector<bench::BenchVertex>& v) {
+            return bench::legacy_load_obj(path, v);
+        });
+        bench::report_throughput("mapped", bytes, iterations, [&](std::vector<bench::BenchVertex>& v) {
+            return bench::mapped_load_obj(path, v);
+        });
+    }
+    return 0;
+}
+
+int bench_obj_scaling(const std::vector<std::string>& paths, int iterations) {
+    unsigned int max_threads = std::max(1u, std::thread::hardware_concurrency());
+    for (const std::string& path : paths) {
+        size_t bytes = bench::file_size(path);
+        if (bytes == 0) {
+            std::cout << "ERROR::BENCH::FILE_NOT_FOUND " << path << std::endl;
+            continue;
+        }
+        std::cout << path << " (" << bytes / 1024 << " KB, " << iterations << " iterations)" << std::endl;
+        ObjData reference;
+        load_obj(path, reference, 1);
+        double single = 0.0;
+        for (unsigned int threads = 1; threads <= max_threads; threads++) {
+            ObjData data;
+            double start = bench::now_seconds();
+            for (int i = 0; i < iterations; i++) {
+                data = ObjData();
+                load_obj(path, data, threads);
+            }
+            double elapsed = (bench::now_seconds() - start) / iterations;
+            if (threads == 1) {
+                single = elapsed;
+            }
+            std::cout << "  " << threads << " threads: " << elapsed * 1000.0 << " ms, "
+                << bytes / elapsed / (1024.0 * 1024.0) << " MB/s, speedup " << single / elapsed
+                << (bench::same_obj(data, reference) ? "" : " ERROR::BENCH::RESULT_MISMATCH") << std::endl;
+        }
+    }
+    return 0;
+}
+
+int bench_mesh_cache(const std::vector<std::string>& paths) {
+    GLFWwindow* window = bench::create_context();
+    if (window == nullptr) {
+        return -1;
+    }
+    for (const std::string& path : paths) {
+        std::remove(mesh_cache_path(path).c_str());
+        double start = bench::now_seconds();
+        {
+            Model cold(path);
+            glFinish();
+        }
+        double cold_time = bench::now_seconds() - start;
+
+        start = bench::now_seconds();
+        {
+            Model warm(path);
+            glFinish();
+        }
+        double warm_time = bench::now_seconds() - start;
+
+        std::cout << path << ": cold " << cold_time * 1000.0 << " ms, warm " << warm_time * 1000.0
+            << " ms (" << bench::file_size(mesh_cache_path(path)) / 1024 << " KB cache)" << std::endl;
+    }
+    bench::destroy_context(window);
+    return 0;
+}
+
+// CPU side of the import only (Model::import) with the mesh cache bypassed, so Assimp runs every time.
+int bench_model_import(const std::vector<std::string>& paths, int copies) {
+    std::vector<std::string> scene;
+    for (int i = 0; i < copies; i++) {
+        scene.insert(scene.end(), paths.begin(), paths.end());
+    }
+
+    double start = bench::now_seconds();
+    for (const std::string& path : scene) {
+        Model::import(path, nullptr, false);
+    }
+    double serial = bench::now_seconds() - start;
+    std::cout << scene.size() << " models, serial: " << serial * 1000.0 << " ms" << std::endl;
+
+    unsigned int max_threads = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned int threads = 1; threads <= max_threads; threads *= 2) {
+        ThreadPool pool(threads);
+        std::vector<std::future<ModelData>> pending;
+        start = bench::now_seconds();
+        for (const std::string& path : scene) {
+            pending.push_back(pool.submit([path, &pool]() {
+                return Model::import(path, &pool, false);
+            }));
+        }
+        for (std::future<ModelData>& result : pending) {
+            result.get();
+        }
+        double elapsed = bench::now_seconds() - start;
+        std::cout << "  pool " << threads << " threads: " << elapsed * 1000.0 << " ms, speedup "
+            << serial / elapsed << std::endl;
+    }
+    return 0;
+}
+
+// Frame times while a model loads mid-run, synchronously on the render thread vs through the upload thread.
+int bench_upload(const std::string& path, int frames) {
+    GLFWwindow* window = bench::create_context();
+    if (window == nullptr) {
+        return -1;
+    }
+    const int load_frame = 10;
+    for (int async = 0; async < 2; async++) {
+        ThreadPool pool;
+        std::unique_ptr<UploadThread> uploader;
+        std::shared_ptr<Model> model;
+        if (async) {
+            uploader = std::make_unique<UploadThread>(window);
+            if (!uploader->is_running()) {
+                break;
+            }
+            TextureCache::instance().set_decode_pool(&pool);
+            TextureCache::instance().set_upload_thread(uploader.get());
+        }
+
+        double worst = 0.0, total = 0.0;
+        int ready_frame = -1;
+        for (int frame = 0; frame < frames; frame++) {
+            double start = bench::now_seconds();
+            if (frame == load_frame) {
+                model = async ? Model::load_async(path, pool, *uploader) : std::make_shared<Model>(path);
+            }
+            if (uploader) {
+                uploader->poll();
+            }
+            TextureCache::instance().upload_pending(TEXTURE_UPLOAD_BUDGET);
+            if (ready_frame < 0 && model && model->is_ready() && TextureCache::instance().stats().pending == 0) {
+                ready_frame = frame;
+            }
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            glFinish();
+            double elapsed = bench::now_seconds() - start;
+            worst = std::max(worst, elapsed);
+            total += elapsed;
+        }
+        std::cout << path << (async ? " upload thread: " : " sync: ") << "worst frame " << worst * 1000.0
+            << " ms, average " << total / frames * 1000.0 << " ms, ready after "
+            << (ready_frame < 0 ? -1 : ready_frame - load_frame) << " frames" << std::endl;
+
+        // Drain before the pool and uploader go away, their callbacks hold the model.
+        while (uploader && (uploader->in_flight() > 0 || !model->is_ready() ||
+            TextureCache::instance().stats().pending > 0)) {
+            uploader->poll();
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        TextureCache::instance().set_decode_pool(nullptr);
+        TextureCache::instance().set_upload_thread(nullptr);
+        model.reset();
+    }
+    bench::destroy_context(window);
+    return 0;
+}
+
+// CPU cost and GL call counts of drawing one model copies times per frame, per-mesh buffers vs merged.
+int bench_draw(const std::string& path, int frames, int copies) {
+    GLFWwindow* window = bench::create_context();
+    if (window == nullptr) {
+        return -1;
+    }
+    {
+        Shader shader("shaders/backpack.vert", "shaders/backpack.frag");
+        Material::assign_units(shader);
+        for (int merged = 0; merged < 2; merged++) {
+            Model model(path, merged != 0);
+            double start = bench::now_seconds();
+            for (int frame = 0; frame < frames; frame++) {
+                draw_stats = DrawStats();
+                GLState::instance().reset_stats();
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+                for (int i = 0; i < copies; i++) {
+                    model.draw(shader);
+                }
+                glFinish();
+            }
+            double elapsed = bench::now_seconds() - start;
+            std::cout << path << (merged ? " merged: " : " per mesh: ") << elapsed / frames * 1000.0
+                << " ms/frame, draws " << draw_stats.draw_calls << ", VAO binds " << draw_stats.vao_binds
+                << ", texture binds " << draw_stats.texture_binds << ", GL state calls "
+                << GLState::instance().stats().issued << " (" << GLState::instance().stats().skipped
+                << " redundant skipped) per frame" << std::endl;
+        }
+    }
+    bench::destroy_context(window);
+    return 0;
+}
+
+// Many copies of one model: a uniform update and draw per copy vs one instanced draw per submesh with
+// the transforms re-uploaded every frame. Once with the unlit light cube shader, once with the lit
+// variants, whose INSTANCED versions read LitInstance's model and normal matrices.
+int bench_instancing(const std::string& path, int frames) {
+    GLFWwindow* window = bench::create_context();
+    if (window == nullptr) {
+        return -1;
+    }
+    {
+        Shader single("shaders/lightSource.vert", "shaders/lightSource.frag");
+        Shader instanced("shaders/lightSource_instanced.vert", "shaders/lightSource.frag");
+        Model model(path, true);
+        glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 0.0f, 200.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+        glm::mat4 projection = glm::perspective(glm::radians(45.0f), 1.0f, 1.0f, 1000.0f);
+        UniformBuffer<CameraBlock> camera("Camera", CAMERA_BLOCK_BINDING);
+        camera.attach(single);
+        camera.attach(instanced);
+        camera.update(CameraBlock::make(view, projection, glm::vec3(0.0f, 0.0f, 200.0f)));
+        InstanceBuffer buffer(sizeof(LightInstance));
+        buffer.add_mat4(INSTANCE_ATTRIBUTE_LOCATION, offsetof(LightInstance, model));
+        buffer.add_attribute(INSTANCE_ATTRIBUTE_LOCATION + 4, 3, offsetof(LightInstance, color));
+
+        ShaderVariants lit("shaders/backpack.vert", "shaders/backpack.frag");
+        UniformBuffer<LightsBlock> lights("Lights", LIGHTS_BLOCK_BINDING);
+        lights.update(LightsBlock());
+        lit.set_on_create([&](Shader& variant) {
+            camera.attach(variant);
+            lights.attach(variant);
+        });
+        Material::assign_units(lit);
+        uint32_t scene_features = shader_features::lights(shader_features::MAX_POINT_LIGHTS);
+        InstanceBuffer lit_buffer(sizeof(LitInstance));
+        lit_buffer.add_mat4(INSTANCE_ATTRIBUTE_LOCATION, offsetof(LitInstance, model));
+        lit_buffer.add_mat3(INSTANCE_ATTRIBUTE_LOCATION + 4, offsetof(LitInstance, normal_matrix));
+
+        const int counts[] = { 4, 100, 1000, 10000, 100000 };
+        for (int count : counts) {
+            std::vector<LightInstance> instances(count);
+            for (int i = 0; i < count; i++) {
+                glm::vec3 position((float)(i % 100) - 50.0f, (float)(i / 100 % 100) - 50.0f, -(float)(i / 10000));
+                instances[i].model = glm::scale(glm::translate(glm::mat4(1.0f), position), glm::vec3(0.2f));
+                instances[i].color = glm::vec3((i % 7) / 7.0f, (i % 5) / 5.0f, (i % 3) / 3.0f);
+            }
+
+            double start = bench::now_seconds();
+            for (int frame = 0; frame < frames; frame++) {
+                draw_stats = DrawStats();
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+                single.use();
+                for (const LightInstance& instance : instances) {
+                    single.setMat4f("model", instance.model);
+                    single.setVec3f("lightColor", instance.color);
+                    model.draw(single);
+                }
+                glFinish();
+            }
+            double loop_time = (bench::now_seconds() - start) / frames;
+            unsigned int loop_draws = draw_stats.draw_calls;
+
+            start = bench::now_seconds();
+            for (int frame = 0; frame < frames; frame++) {
+                draw_stats = DrawStats();
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+                instanced.use();
+                buffer.update(instances.data(), instances.size());
+                model.draw_instanced(instanced, buffer);
+                glFinish();
+            }
+            double instanced_time = (bench::now_seconds() - start) / frames;
+
+            std::cout << count << " instances: loop " << loop_time * 1000.0 << " ms (" << loop_draws
+                << " draws), instanced " << instanced_time * 1000.0 << " ms (" << draw_stats.draw_calls
+                << " draws), speedup " << loop_time / instanced_time << std::endl;
+
+            std::vector<LitInstance> lit_instances(count);
+            for (int i = 0; i < count; i++) {
+                glm::mat4 rotated = glm::rotate(instances[i].model, glm::radians((float)i), glm::vec3(0.0f, 1.0f, 0.0f));
+                lit_instances[i] = LitInstance::make(rotated);
+            }
+            // An untimed frame submits the variants of both paths, then their compiles are waited for.
+            lit_buffer.update(lit_instances.data(), lit_instances.size());
+            model.draw(lit, scene_features);
+            model.draw_instanced(lit, scene_features, lit_buffer);
+            while (lit.pending() > 0) {
+                lit.poll();
+            }
+
+            start = bench::now_seconds();
+            for (int frame = 0; frame < frames; frame++) {
+                draw_stats = DrawStats();
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+                for (const LitInstance& instance : lit_instances) {
+                    lit.set_transform(instance.model, instance.normal_matrix);
+                    model.draw(lit, scene_features);
+                }
+                glFinish();
+            }
+            loop_time = (bench::now_seconds() - start) / frames;
+            loop_draws = draw_stats.draw_calls;
+
+            start = bench::now_seconds();
+            for (int frame = 0; frame < frames; frame++) {
+                draw_stats = DrawStats();
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+                lit_buffer.update(lit_instances.data(), lit_instances.size());
+                model.draw_instanced(lit, scene_features, lit_buffer);
+                glFinish();
+            }
+            instanced_time = (bench::now_seconds() - start) / frames;
+
+            std::cout << count << " lit instances: loop " << loop_time * 1000.0 << " ms (" << loop_draws
+                << " draws), instanced " << instanced_time * 1000.0 << " ms (" << draw_stats.draw_calls
+                << " draws), speedup " << loop_time / instanced_time << std::endl;
+        }
+    }
+    bench::destroy_context(window);
+    return 0;
+}
+
+// Per-call cost of a uniform write: lookup by name in the driver (the old Shader setters), lookup in
+// the reflected map, and a typed handle resolved up front.
+int bench_uniforms(int iterations) {
+    GLFWwindow* window = bench::create_context();
+    if (window == nullptr) {
+        return -1;
+    }
+    {
+        Shader shader("shaders/backpack.vert", "shaders/backpack.frag");
+        shader.use();
+        const char* names[] = { "material.diffuse[0]", "material.diffuse[1]", "material.specular[0]", "material.emission[2]" };
+        const int name_count = 4;
+
+        glFinish();
+        double start = bench::now_seconds();
+        for (int i = 0; i < iterations; i++) {
+            std::string name = names[i % name_count];
+            glUniform1i(glGetUniformLocation(shader.ID, name.c_str()), i & 7);
+        }
+        glFinish();
+        double driver = (bench::now_seconds() - start) / iterations;
+
+        start = bench::now_seconds();
+        for (int i = 0; i < iterations; i++) {
+            shader.setInt(names[i % name_count], i & 7);
+        }
+        glFinish();
+        double reflected = (bench::now_seconds() - start) / iterations;
+
+        Uniform<int> handles[name_count];
+        for (int i = 0; i < name_count; i++) {
+            handles[i] = shader.uniform<int>(names[i]);
+        }
+        start = bench::now_seconds();
+        for (int i = 0; i < iterations; i++) {
+            shader.set(handles[i % name_count], i & 7);
+        }
+        glFinish();
+        double handle = (bench::now_seconds() - start) / iterations;
+
+        std::cout << "glGetUniformLocation per call: " << driver * 1e9 << " ns, reflected map: "
+            << reflected * 1e9 << " ns, typed handle: " << handle * 1e9 << " ns" << std::endl;
+    }
+    bench::destroy_context(window);
+    return 0;
+}
+
+// Time to build every program the renderer uses, from source with an empty program cache (cold) and
+// from the binaries that run stored (warm). Drivers with their own shader cache, such as Mesa's, make
+// the cold run look faster unless it is disabled (MESA_SHADER_CACHE_DISABLE=true).
+int bench_program_cache() {
+    GLFWwindow* window = bench::create_context();
+    if (window == nullptr) {
+        return -1;
+    }
+    const char* programs[][2] = {
+        { "shaders/backpack.vert", "shaders/backpack.frag" },
+        { "shaders/lightSource.vert", "shaders/lightSource.frag" },
+        { "shaders/lightSource_instanced.vert", "shaders/lightSource.frag" },
+    };
+    ProgramCache& cache = ProgramCache::instance();
+    if (!cache.is_supported()) {
+        std::cout << "ERROR::BENCH::NO_PROGRAM_BINARY_FORMATS" << std::endl;
+    }
+    cache.clear();
+    for (int warm = 0; warm < 2; warm++) {
+        double start = bench::now_seconds();
+        for (const auto& program : programs) {
+            Shader shader(program[0], program[1]);
+            glFinish();
+        }
+        std::cout << (warm ? "warm: " : "cold: ") << (bench::now_seconds() - start) * 1000.0 << " ms" << std::endl;
+    }
+    cache.print_stats();
+    bench::destroy_context(window);
+    return 0;
+}
+
+// Building every material variant of the lit shader: one blocking get() after another vs submitting the
+// whole batch and polling. The program cache is off, and each run tags its sources so driver side shader
+// caches can't serve the second run either.
+int bench_shader_compile() {
+    GLFWwindow* window = bench::create_context();
+    if (window == nullptr) {
+        return -1;
+    }
+    ProgramCache::instance().set_enabled(false);
+    std::vector<uint32_t> features;
+    for (int diffuse = 0; diffuse <= 3; diffuse++) {
+        for (int specular = 0; specular <= 3; specular++) {
+            for (int emission = 0; emission <= 1; emission++) {
+                features.push_back(shader_features::material(diffuse, specular, emission) |
+                    shader_features::lights(4));
+            }
+        }
+    }
+    std::string tag = std::to_string((long long)(bench::now_seconds() * 1000.0));
+    std::cout << features.size() << " variants, parallel compile "
+        << (parallel_compile::supported() ? "supported" : "not supported") << std::endl;
+
+    for (int batch = 0; batch < 2; batch++) {
+        ShaderVariants variants("shaders/backpack.vert", "shaders/backpack.frag", [&](uint32_t feature) {
+            return shader_features::defines(feature) + "// " + tag + (batch ? " batch" : " serial") + "\n";
+        });
+        double worst = 0.0;
+        double start = bench::now_seconds();
+        if (batch) {
+            variants.prepare(features);
+            worst = bench::now_seconds() - start;
+            while (variants.pending() > 0) {
+                double poll_start = bench::now_seconds();
+                variants.poll();
+                worst = std::max(worst, bench::now_seconds() - poll_start);
+            }
+        }
+        else {
+            for (uint32_t feature : features) {
+                double get_start = bench::now_seconds();
+                variants.get(feature);
+                worst = std::max(worst, bench::now_seconds() - get_start);
+            }
+        }
+        std::cout << (batch ? "batch + poll: " : "serial get: ") << (bench::now_seconds() - start) * 1000.0
+            << " ms total, longest blocking call " << worst * 1000.0 << " ms" << std::endl;
+    }
+    ProgramCache::instance().set_enabled(true);
+    bench::destroy_context(window);
+    return 0;
+}
+
+// Cost of a TRACE_SCOPE with no capture running and while recording, no GL needed.
+int bench_trace(int iterations) {
+#ifdef ENABLE_TRACE
+    double start = bench::now_seconds();
+    for (int i = 0; i < iterations; i++) {
+        TRACE_SCOPE("bench_trace");
+    }
+    double idle = (bench::now_seconds() - start) / iterations;
+    // Stays under TRACE_BUFFER_EVENTS so every scope takes the recording path.
+    double recording = trace::measure_scope_ns((int)std::min<size_t>(iterations, TRACE_BUFFER_EVENTS)) * 1e-9;
+    std::cout << "TRACE_SCOPE idle: " << idle * 1e9 << " ns, recording: " << recording * 1e9 << " ns" << std::endl;
+    return 0;
+#else
+    (void)iterations;
+    std::cout << "ERROR::TRACE::NOT_COMPILED_IN build with ENABLE_TRACE" << std::endl;
+    return -1;
+#endif
+}
+
+// Frustum culling of random boxes around the default camera, scalar against the SIMD paths.
+int bench_culling(size_t boxes, int iterations) {
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<float> position(-100.0f, 100.0f);
+    std::uniform_real_distribution<float> size(0.1f, 2.0f);
+    AABBList list;
+    list.reserve(boxes);
+    for (size_t i = 0; i < boxes; i++) {
+        glm::vec3 center(position(rng), position(rng), position(rng));
+        AABB box;
+        box.expand(center - glm::vec3(size(rng)));
+        box.expand(center + glm::vec3(size(rng)));
+        list.push_back(box);
+    }
+    Camera cam;
+    Frustum frustum = cam.frustum(glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 1.0f, 100.0f));
+
+    std::vector<uint8_t> reference(boxes), visible(boxes);
+    size_t expected = frustum::cull_scalar(frustum, list, reference.data());
+    std::cout << "CULLING " << boxes << " boxes, " << expected << " visible" << std::endl;
+    auto run = [&](const char* name, size_t (*cull)(const Frustum&, const AABBList&, uint8_t*)) {
+        size_t count = 0;
+        double start = bench::now_seconds();
+        for (int i = 0; i < iterations; i++) {
+            count = cull(frustum, list, visible.data());
+        }
+        double elapsed = (bench::now_seconds() - start) / iterations;
+        bool same = count == expected && visible == reference;
+        std::cout << name << ": " << elapsed * 1000.0 << " ms, " << elapsed * 1e9 / boxes << " ns per box"
+            << (same ? "" : " MISMATCH") << std::endl;
+        return same;
+    };
+    bool same = run("scalar", frustum::cull_scalar);
+#ifdef FRUSTUM_X86
+    same = run("sse", frustum::cull_sse) && same;
+    if (frustum::has_avx()) {
+        same = run("avx", frustum::cull_avx) && same;
+    }
+#endif
+    return same ? 0 : -1;
+}
+
+// BVH build and refit times and query throughput over random instance boxes, each query checked
+// against a linear scan of the same boxes.
+int bench_bvh(size_t instances, int queries) {
+    std::mt19937 rng(11);
+    std::uniform_real_distribution<float> position(-200.0f, 200.0f);
+    std::uniform_real_distribution<float> size(0.2f, 3.0f);
+    std::uniform_real_distribution<float> step(-0.5f, 0.5f);
+    std::vector<AABB> boxes(instances);
+    AABBList list;
+    list.reserve(instances);
+    for (AABB& box : boxes) {
+        glm::vec3 center(position(rng), position(rng), position(rng));
+        box.expand(center - glm::vec3(size(rng)));
+        box.expand(center + glm::vec3(size(rng)));
+        list.push_back(box);
+    }
+
+    BVH bvh;
+    double start = bench::now_seconds();
+    bvh.build(boxes);
+    double build = bench::now_seconds() - start;
+    BVHStats stats = bvh.stats();
+    std::cout << "BVH " << instances << " instances: build " << build * 1000.0 << " ms, " << stats.nodes << " nodes, "
+        << stats.leaves << " leaves, depth " << stats.depth << ", SAH cost " << stats.sah_cost << std::endl;
+
+    // Everything moves a little, as a frame of animated instances would.
+    std::vector<AABB> moved = boxes;
+    for (AABB& box : moved) {
+        glm::vec3 offset(step(rng), step(rng), step(rng));
+        box.min += offset;
+        box.max += offset;
+    }
+    start = bench::now_seconds();
+    bvh.refit(moved);
+    std::cout << "refit: " << (bench::now_seconds() - start) * 1000.0 << " ms" << std::endl;
+    bvh.build(boxes);
+
+    // Cameras scattered through the scene, looking in random directions.
+    std::vector<Frustum> frustums;
+    std::vector<glm::vec3> origins, rays;
+    std::vector<AABB> regions;
+    glm::mat4 projection = glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 1.0f, 100.0f);
+    for (int i = 0; i < queries; i++) {
+        glm::vec3 eye(position(rng), position(rng), position(rng));
+        glm::vec3 ray = glm::normalize(glm::vec3(step(rng), step(rng), step(rng)) + glm::vec3(0.0f, 0.0f, 1e-3f));
+        Camera cam;
+        cam.look_from(eye, eye + ray);
+        frustums.push_back(cam.frustum(projection));
+        origins.push_back(eye);
+        rays.push_back(ray);
+        AABB region;
+        region.expand(eye - glm::vec3(10.0f));
+        region.expand(eye + glm::vec3(10.0f));
+        regions.push_back(region);
+    }
+
+    bool same = true;
+    std::vector<uint8_t> visible(instances);
+    size_t found = 0, expected = 0;
+    start = bench::now_seconds();
+    for (const Frustum& frustum : frustums) {
+        bvh.query_frustum(frustum, [&found](uint32_t) { found++; });
+    }
+    double tree = bench::now_seconds() - start;
+    start = bench::now_seconds();
+    for (const Frustum& frustum : frustums) {
+        expected += frustum::cull(frustum, list, visible.data());
+    }
+    double linear = bench::now_seconds() - start;
+    same = same && found == expected;
+    std::cout << "frustum: " << tree * 1e6 / queries << " us per query, SIMD scan " << linear * 1e6 / queries
+        << " us, " << found / queries << " visible" << (found == expected ? "" : " MISMATCH") << std::endl;
+
+    found = 0;
+    expected = 0;
+    start = bench::now_seconds();
+    for (const AABB& region : regions) {
+        bvh.query_overlap(region, [&found](uint32_t) { found++; });
+    }
+    tree = bench::now_seconds() - start;
+    start = bench::now_seconds();
+    for (const AABB& region : regions) {
+        for (const AABB& box : boxes) {
+            expected += bvh::overlaps(box, region) ? 1 : 0;
+        }
+    }
+    linear = bench::now_seconds() - start;
+    same = same && found == expected;
+    std::cout << "overlap: " << tree * 1e6 / queries << " us per query, scan " << linear * 1e6 / queries << " us"
+        << (found == expected ? "" : " MISMATCH") << std::endl;
+
+    size_t mismatched = 0;
+    std::vector<float> distances(queries);
+    start = bench::now_seconds();
+    for (int i = 0; i < queries; i++) {
+        distances[i] = 1000.0f;
+        bvh.raycast(origins[i], rays[i], distances[i]);
+    }
+    tree = bench::now_seconds() - start;
+    start = bench::now_seconds();
+    for (int i = 0; i < queries; i++) {
+        glm::vec3 inv_ray = 1.0f / rays[i];
+        float nearest = 1000.0f, entry;
+        for (const AABB& box : boxes) {
+            if (bvh::ray_box(origins[i], inv_ray, box, nearest, entry)) {
+                nearest = entry;
+            }
+        }
+        mismatched += nearest == distances[i] ? 0 : 1;
+    }
+    linear = bench::now_seconds() - start;
+    same = same && mismatched == 0;
+    std::cout << "raycast: " << queries / tree << " rays/s, scan " << queries / linear << " rays/s"
+        << (mismatched == 0 ? "" : " MISMATCH") << std::endl;
+    return same ? 0 : -1;
+}
+
+// Software occlusion culling on a synthetic city: rows of wall-like blocks as occluders and random boxes
+// behind and between them as occludees. Runs on the CPU only, no context needed.
+int bench_occlusion(size_t occludees, int frames) {
+    std::mt19937 rng(5);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    OccluderMesh occluders;
+    for (int row = 0; row < 6; row++) {
+        for (int i = 0; i < 12; i++) {
+            glm::vec3 low(-60.0f + i * 10.0f + unit(rng) * 3.0f, -2.0f, -10.0f - row * 12.0f);
+            AABB block;
+            block.expand(low);
+            block.expand(low + glm::vec3(4.0f + unit(rng) * 4.0f, 4.0f + unit(rng) * 8.0f, 1.0f + unit(rng) * 2.0f));
+            bench::add_box(block, occluders);
+        }
+    }
+    std::vector<AABB> boxes(occludees);
+    for (AABB& box : boxes) {
+        glm::vec3 center(-80.0f + unit(rng) * 160.0f, -2.0f + unit(rng) * 6.0f, -5.0f - unit(rng) * 90.0f);
+        glm::vec3 extent = glm::vec3(0.2f) + glm::vec3(unit(rng), unit(rng), unit(rng)) * 0.8f;
+        box.expand(center - extent);
+        box.expand(center + extent);
+    }
+    glm::mat4 view_projection = glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 1.0f, 100.0f) *
+        glm::lookAt(glm::vec3(0.0f, 1.5f, 0.0f), glm::vec3(0.0f, 1.5f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    std::cout << "OCCLUSION " << occluders.indices.size() / 3 << " occluder triangles, " << occludees
+        << " boxes, " << OCCLUSION_WIDTH << "x" << OCCLUSION_HEIGHT << std::endl;
+
+    ThreadPool pool;
+    OcclusionBuffer reference;
+    reference.set_simd(false);
+    reference.add_occluder(occluders, view_projection);
+    reference.render(nullptr);
+
+    bool same = true;
+    auto run = [&](const char* name, bool simd, ThreadPool* threads) {
+        OcclusionBuffer buffer;
+        buffer.set_simd(simd);
+        double start = bench::now_seconds();
+        for (int i = 0; i < frames; i++) {
+            buffer.clear();
+            buffer.add_occluder(occluders, view_projection);
+            buffer.render(threads);
+        }
+        double elapsed = (bench::now_seconds() - start) / frames;
+        bool matches = buffer.get_depth() == reference.get_depth();
+        same = same && matches;
+        std::cout << name << ": " << elapsed * 1000.0 << " ms per frame" << (matches ? "" : " MISMATCH") << std::endl;
+    };
+    run("scalar, 1 thread", false, nullptr);
+    run("simd, 1 thread", true, nullptr);
+    run("simd, pool", true, &pool);
+
+    size_t occluded = 0;
+    double start = bench::now_seconds();
+    for (const AABB& box : boxes) {
+        occluded += reference.is_visible(box, view_projection) ? 0 : 1;
+    }
+    double elapsed = bench::now_seconds() - start;
+    std::cout << "test: " << elapsed * 1e9 / occludees << " ns per box, " << occluded << " of " << occludees
+        << " occluded" << std::endl;
+    reference.write_pgm("occlusion.pgm");
+    return same ? 0 : -1;
+}
@@ -0,0 +1,200 @@
+#pragma once
+
+#include <FrameStats.h>
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+
+// Relative slowdown of a baseline metric that counts as a regression.
+const double BENCHMARK_REGRESSION_THRESHOLD = 0.10;
+
+// Counters summed over the measured frames of a headless run.
+struct BenchmarkCounters {
+    uint64_t draw_calls = 0;
+    uint64_t vao_binds = 0;
+    uint64_t texture_binds = 0;
+    uint64_t triangles = 0;
+    uint64_t visible_meshes = 0;
+    uint64_t culled_meshes = 0;
+    uint64_t occluded_meshes = 0;
+    // Draws and triangles skipped by GPU occlusion queries.
+    uint64_t saved_draws = 0;
+    uint64_t saved_triangles = 0;
+    uint64_t state_calls = 0;
+    uint64_t redundant_state_calls = 0;
+};
+
+struct BenchmarkReport {
+    std::string context_api;
+    std::string gl_renderer;
+    int width = 0;
+    int height = 0;
+    int warmup_frames = 0;
+    FrameSummary cpu;
+    FrameSummary gpu;
+    BenchmarkCounters counters;
+    std::vector<double> frame_times;
+};
+
+namespace benchmark_report {
+    void write_summary(std::ostream& out, const char* name, const FrameSummary& summary) {
+        char text[256];
+        std::snprintf(text, sizeof(text),
+            "  \"%s\": { \"frames\": %zu, \"average\": %.4f, \"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"max\": %.4f }",
+            name, summary.frames, summary.average, summary.p50, summary.p95, summary.p99, summary.max);
+        out << text;
+    }
+
+    double per_frame(uint64_t total, size_t frames) {
+        return frames == 0 ? 0.0 : (double)total / frames;
+    }
+
+    // Quotes text as a JSON string, GL_RENDERER is driver supplied and may contain anything.
+    std::string quote(const std::string& text) {
+        std::string quoted = "\"";
+        for (unsigned char c : text) {
+            if (c == '"' || c == '\\') {
+                quoted += '\\';
+                quoted += (char)c;
+            } else if (c < 0x20) {
+                char escape[8];
+                std::snprintf(escape, sizeof(escape), "\\u%04x", c);
+                quoted += escape;
+            } else {
+                quoted += (char)c;
+            }
+        }
+        return quoted + "\"";
+    }
+
+    // Position just past the ':' of the member named key of the object opening at text[open], npos when
+    // there is none. Members of nested values and text inside strings never match.
+    size_t find_member(const std::string& text, size_t open, const std::string& key) {
+        int depth = 0;
+        for (size_t i = open; i < text.size(); i++) {
+            char c = text[i];
+            if (c == '{' || c == '[') {
+                depth++;
+            } else if (c == '}' || c == ']') {
+                if (--depth <= 0) {
+                    return std::string::npos;
+                }
+            } else if (c == '"') {
+                size_t start = ++i;
+                while (i < text.size() && text[i] != '"') {
+                    i += text[i] == '\\' ? 2 : 1;
+                }
+                size_t colon = text.find_first_not_of(" \t\r\n", i + 1);
+                if (depth == 1 && colon != std::string::npos && text[colon] == ':' &&
+                    text.compare(start, i - start, key) == 0 && i - start == key.size()) {
+                    return colon + 1;
+                }
+            }
+        }
+        return std::string::npos;
+    }
+
+    // Reads the number text.section.key out of a report written by write_benchmark_json. Only meant for
+    // our own output, it is not a general JSON parser.
+    bool read_number(const std::string& text, const std::string& section, const std::string& key, double& value) {
+        size_t found = find_member(text, text.find('{'), section);
+        if (found == std::string::npos) {
+            return false;
+        }
+        found = text.find_first_not_of(" \t\r\n", found);
+        if (found == std::string::npos || text[found] != '{') {
+            return false;
+        }
+        found = find_member(text, found, key);
+        if (found == std::string::npos) {
+            return false;
+        }
+        const char* begin = text.c_str() + found;
+        char* end = nullptr;
+        value = std::strtod(begin, &end);
+        return end != begin;
+    }
+}
+
+// Times are milliseconds, counters are per measured frame, frame_times_ms lists every measured frame.
+bool write_benchmark_json(const std::string& path, const BenchmarkReport& report) {
+    std::ofstream out(path, std::ofstream::trunc);
+    if (!out) {
+        std::cout << "ERROR::BENCHMARK::OPEN_FAILED " << path << std::endl;
+        return false;
+    }
+    size_t frames = report.cpu.frames;
+    out << "{\n";
+    out << "  \"context_api\": " << benchmark_report::quote(report.context_api) << ",\n";
+    out << "  \"gl_renderer\": " << benchmark_report::quote(report.gl_renderer) << ",\n";
+    out << "  \"width\": " << report.width << ",\n";
+    out << "  \"height\": " << report.height << ",\n";
+    out << "  \"warmup_frames\": " << report.warmup_frames << ",\n";
+    benchmark_report::write_summary(out, "cpu_frame_ms", report.cpu);
+    out << ",\n";
+    benchmark_report::write_summary(out, "gpu_frame_ms", report.gpu);
+    out << ",\n";
+    char text[512];
+    std::snprintf(text, sizeof(text),
+        "  \"per_frame\": { \"draw_calls\": %.2f, \"vao_binds\": %.2f, \"texture_binds\": %.2f, \"triangles\": %.1f, "
+        "\"visible_meshes\": %.2f, \"culled_meshes\": %.2f, \"occluded_meshes\": %.2f, \"saved_draws\": %.2f, \"saved_triangles\": %.1f, \"state_calls\": %.2f, \"redundant_state_calls\": %.2f },\n",
+        benchmark_report::per_frame(report.counters.draw_calls, frames),
+        benchmark_report::per_frame(report.counters.vao_binds, frames),
+        benchmark_report::per_frame(report.counters.texture_binds, frames),
+        benchmark_report::per_frame(report.counters.triangles, frames),
+        benchmark_report::per_frame(report.counters.visible_meshes, frames),
+        benchmark_report::per_frame(report.counters.culled_meshes, frames),
+        benchmark_report::per_frame(report.counters.occluded_meshes, frames),
+        benchmark_report::per_frame(report.counters.saved_draws, frames),
+        benchmark_report::per_frame(report.counters.saved_triangles, frames),
+        benchmark_report::per_frame(report.counters.state_calls, frames),
+        benchmark_report::per_frame(report.counters.redundant_state_calls, frames));
+    out << text;
+    out << "  \"frame_times_ms\": [";
+    for (size_t i = 0; i < report.frame_times.size(); i++) {
+        std::snprintf(text, sizeof(text), "%s%.4f", i == 0 ? "" : ", ", report.frame_times[i]);
+        out << text;
+    }
+    out << "]\n}\n";
+    return (bool)out;
+}
+
+// Compares the time percentiles and per-frame counters of two reports. Returns the number of metrics
+// that got worse by more than the threshold, -1 when the baseline can't be read.
+int compare_benchmark_json(const std::string& baseline_path, const std::string& current_path,
+    double threshold = BENCHMARK_REGRESSION_THRESHOLD) {
+    std::ifstream baseline_file(baseline_path), current_file(current_path);
+    if (!baseline_file || !current_file) {
+        std::cout << "ERROR::BENCHMARK::BASELINE_OPEN_FAILED " << baseline_path << std::endl;
+        return -1;
+    }
+    std::stringstream baseline_text, current_text;
+    baseline_text << baseline_file.rdbuf();
+    current_text << current_file.rdbuf();
+
+    const char* metrics[][2] = {
+        { "cpu_frame_ms", "average" }, { "cpu_frame_ms", "p50" }, { "cpu_frame_ms", "p95" }, { "cpu_frame_ms", "p99" },
+        { "gpu_frame_ms", "average" }, { "gpu_frame_ms", "p95" },
+        { "per_frame", "draw_calls" }, { "per_frame", "state_calls" }, { "per_frame", "triangles" }
+    };
+    int regressions = 0;
+    for (const auto& metric : metrics) {
+        double before = 0.0, after = 0.0;
+        if (!benchmark_report::read_number(baseline_text.str(), metric[0], metric[1], before) ||
+            !benchmark_report::read_number(current_text.str(), metric[0], metric[1], after) || before <= 0.0) {
+            continue;
+        }
+        double change = (after - before) / before;
+        bool regressed = change > threshold;
+        regressions += regressed ? 1 : 0;
+        std::printf("%s %s.%s: %.3f -> %.3f (%+.1f%%)\n", regressed ? "REGRESSION" : "ok", metric[0], metric[1],
+            before, after, change * 100.0);
+    }
+    return regressions;
+}
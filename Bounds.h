@@ -0,0 +1,48 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cfloat>
+
+// Axis aligned bounding box. A default constructed box is empty: min above max, so the first
+// expand() sets both corners.
+struct AABB {
+    glm::vec3 min = glm::vec3(FLT_MAX);
+    glm::vec3 max = glm::vec3(-FLT_MAX);
+
+    void expand(const glm::vec3& point);
+    void expand(const AABB& other);
+    bool is_empty() const { return min.x > max.x; }
+    glm::vec3 center() const { return (min + max) * 0.5f; }
+    glm::vec3 extent() const { return (max - min) * 0.5f; }
+    // Box around the eight transformed corners.
+    AABB transformed(const glm::mat4& matrix) const;
+};
+
+void AABB::expand(const glm::vec3& point) {
+    min = glm::min(min, point);
+    max = glm::max(max, point);
+}
+
+void AABB::expand(const AABB& other) {
+    if (other.is_empty()) {
+        return;
+    }
+    min = glm::min(min, other.min);
+    max = glm::max(max, other.max);
+}
+
+AABB AABB::transformed(const glm::mat4& matrix) const {
+    if (is_empty()) {
+        return *this;
+    }
+    // Arvo: the new extent along each axis is the absolute linear part applied to the old extent.
+    glm::vec3 center = glm::vec3(matrix * glm::vec4(this->center(), 1.0f));
+    glm::mat3 linear = glm::mat3(matrix);
+    glm::vec3 half = this->extent();
+    glm::vec3 extent = glm::abs(linear[0]) * half.x + glm::abs(linear[1]) * half.y + glm::abs(linear[2]) * half.z;
+    AABB result;
+    result.min = center - extent;
+    result.max = center + extent;
+    return result;
+}
@@ -6,6 +6,17 @@
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 
+#include <Trace.h>
+#include <Frustum.h>
+
+#include <cmath>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+
 namespace camera {
     bool FIRST_MOUSE = true;
     double last_x = 0;
@@ -13,6 +24,14 @@ namespace camera {
     float offset_x = 0.0;
     float offset_y = 0.0;
     float zoom = 45.0f;
+
+    // Uniform Catmull-Rom between p1 and p2.
+    glm::vec3 catmull_rom(const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& p2, const glm::vec3& p3, float t) {
+        float t2 = t * t;
+        float t3 = t2 * t;
+        return 0.5f * (2.0f * p1 + (p2 - p0) * t + (2.0f * p0 - 5.0f * p1 + 4.0f * p2 - p3) * t2 +
+            (3.0f * p1 - p0 - 3.0f * p2 + p3) * t3);
+    }
 }
 
 class Camera {
@@ -27,6 +46,34 @@ public:
     void mouse_scroll();
     void process_cam_movement(GLFWwindow* window, float delta_time);
     void update_vectors();
+    // Places the camera at eye facing point, keeping yaw and pitch in step for the mouse.
+    void look_from(const glm::vec3& eye, const glm::vec3& point);
+    // World space planes of what the camera sees through projection.
+    Frustum frustum(const glm::mat4& projection) const { return Frustum::from_matrix(projection * look_at); }
+    // World space ray through x, y in normalized device coordinates, (0, 0) being the screen centre.
+    void pick_ray(float x, float y, const glm::mat4& projection, glm::vec3& origin, glm::vec3& ray) const;
+};
+
+struct CameraKey {
+    glm::vec3 eye;
+    glm::vec3 point;
+};
+
+// Camera keyframes played back by frame number rather than by time, so every run renders the same
+// frames whatever the frame rate. Positions are interpolated with Catmull-Rom through the keys.
+class CameraPath {
+public:
+    void add(const glm::vec3& eye, const glm::vec3& point) { keys.push_back({ eye, point }); }
+    // One key per line: eye x y z, point x y z. Lines starting with # are skipped.
+    bool load(const std::string& path);
+    // t runs from 0 at the first key to 1 at the last.
+    CameraKey sample(float t) const;
+    size_t size() const { return keys.size(); }
+
+    // A loop around center that also rises and falls, the default benchmark path.
+    static CameraPath orbit(const glm::vec3& center, float radius, float height, int keys);
+private:
+    std::vector<CameraKey> keys;
 };
 
 Camera::Camera() {
@@ -95,6 +142,7 @@ void Camera::mouse_scroll() {
 }
 
 void Camera::process_cam_movement(GLFWwindow* window, float delta_time) {
+    TRACE_SCOPE("Camera::process_cam_movement");
     keyboard_movement(window, delta_time);
     mouse_movement();
     mouse_scroll();
@@ -103,4 +151,69 @@ void Camera::process_cam_movement(GLFWwindow* window, float delta_time) {
 void Camera::update_vectors() {
     direction = position + target;
     look_at = glm::lookAt(position, direction, up);
-}
\ No newline at end of file
+}
+
+void Camera::look_from(const glm::vec3& eye, const glm::vec3& point) {
+    position = eye;
+    target = glm::normalize(point - eye);
+    pitch = glm::degrees(asin(target.y));
+    yaw = glm::degrees(atan2(target.z, target.x));
+    update_vectors();
+}
+
+void Camera::pick_ray(float x, float y, const glm::mat4& projection, glm::vec3& origin, glm::vec3& ray) const {
+    glm::mat4 inverse = glm::inverse(projection * look_at);
+    glm::vec4 near = inverse * glm::vec4(x, y, -1.0f, 1.0f);
+    glm::vec4 far = inverse * glm::vec4(x, y, 1.0f, 1.0f);
+    origin = glm::vec3(near) / near.w;
+    ray = glm::normalize(glm::vec3(far) / far.w - origin);
+}
+
+bool CameraPath::load(const std::string& path) {
+    std::ifstream file(path);
+    if (!file) {
+        std::cout << "ERROR::CAMERA_PATH::OPEN_FAILED " << path << std::endl;
+        return false;
+    }
+    keys.clear();
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        std::istringstream values(line);
+        CameraKey key;
+        if (values >> key.eye.x >> key.eye.y >> key.eye.z >> key.point.x >> key.point.y >> key.point.z) {
+            keys.push_back(key);
+        }
+    }
+    return !keys.empty();
+}
+
+CameraKey CameraPath::sample(float t) const {
+    if (keys.empty()) {
+        return { glm::vec3(0.0f, 0.0f, 3.0f), glm::vec3(0.0f) };
+    }
+    if (keys.size() == 1) {
+        return keys[0];
+    }
+    float position = glm::clamp(t, 0.0f, 1.0f) * (keys.size() - 1);
+    size_t i = std::min((size_t)position, keys.size() - 2);
+    float f = position - i;
+    const CameraKey& k0 = keys[i == 0 ? 0 : i - 1];
+    const CameraKey& k1 = keys[i];
+    const CameraKey& k2 = keys[i + 1];
+    const CameraKey& k3 = keys[std::min(i + 2, keys.size() - 1)];
+    return { camera::catmull_rom(k0.eye, k1.eye, k2.eye, k3.eye, f),
+        camera::catmull_rom(k0.point, k1.point, k2.point, k3.point, f) };
+}
+
+CameraPath CameraPath::orbit(const glm::vec3& center, float radius, float height, int keys) {
+    CameraPath path;
+    for (int i = 0; i <= keys; i++) {
+        float angle = glm::radians(360.0f) * i / keys;
+        glm::vec3 eye = center + glm::vec3(radius * cos(angle), height * sin(2.0f * angle), radius * sin(angle));
+        path.add(eye, center);
+    }
+    return path;
+}
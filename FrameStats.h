@@ -0,0 +1,179 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdint>
+#include <iostream>
+
+// Frames kept for the rolling statistics, about eight seconds at 60 FPS.
+const size_t FRAME_STATS_CAPACITY = 512;
+// Seconds between window title updates, glfwSetWindowTitle is far too slow to call every frame.
+const double FRAME_STATS_REPORT_INTERVAL = 0.5;
+
+// Milliseconds over the frames currently in the window.
+struct FrameSummary {
+    size_t frames = 0;
+    double average = 0.0;
+    double p50 = 0.0;
+    double p95 = 0.0;
+    double p99 = 0.0;
+    double max = 0.0;
+};
+
+// Frame times in a fixed ring buffer with rolling average, percentiles and max. Tail latency shows up
+// in p99 and max long before it moves the average. Recording never allocates; summary() sorts into a
+// scratch buffer sized up front. Every frame can also be appended to a CSV file for offline analysis.
+class FrameStats {
+public:
+    FrameStats(size_t capacity = FRAME_STATS_CAPACITY);
+    ~FrameStats();
+    FrameStats(const FrameStats&) = delete;
+    FrameStats& operator=(const FrameStats&) = delete;
+
+    // Records the time since the previous tick, the first tick only starts the clock.
+    void tick(double now_seconds);
+    void add(double frame_seconds);
+    void clear();
+
+    FrameSummary summary() const;
+    // True at most once per interval, for throttled title or overlay updates.
+    bool should_report(double now_seconds, double interval = FRAME_STATS_REPORT_INTERVAL);
+    std::string format() const;
+    void print_summary() const;
+
+    // Writes "frame,ms" rows from the next frame on. The file is truncated so it holds one run only.
+    // False when the file can't be opened.
+    bool open_csv(const std::string& path);
+    void close_csv();
+    // Frame times in the window in milliseconds, oldest first.
+    std::vector<double> samples() const;
+    // Total frames recorded since construction or clear(), not only those still in the window.
+    uint64_t frame_count() const { return total_frames; }
+private:
+    std::vector<double> times;
+    mutable std::vector<double> scratch;
+    size_t next = 0;
+    size_t count = 0;
+    uint64_t total_frames = 0;
+    double last_tick = -1.0;
+    double last_report = -1.0;
+    std::ofstream csv;
+};
+
+namespace frame_stats {
+    // Nearest-rank percentile of the first count values, which end up partially reordered.
+    double percentile(std::vector<double>& values, size_t count, double p) {
+        size_t rank = (size_t)std::ceil(p * count);
+        size_t index = rank == 0 ? 0 : rank - 1;
+        std::nth_element(values.begin(), values.begin() + index, values.begin() + count);
+        return values[index];
+    }
+}
+
+FrameStats::FrameStats(size_t capacity) {
+    times.resize(capacity > 0 ? capacity : 1);
+    scratch.resize(times.size());
+}
+
+FrameStats::~FrameStats() {
+    close_csv();
+}
+
+void FrameStats::tick(double now_seconds) {
+    if (last_tick >= 0.0) {
+        add(now_seconds - last_tick);
+    }
+    last_tick = now_seconds;
+}
+
+void FrameStats::add(double frame_seconds) {
+    double ms = frame_seconds * 1000.0;
+    times[next] = ms;
+    next = (next + 1) % times.size();
+    count = std::min(count + 1, times.size());
+    total_frames++;
+    if (csv.is_open()) {
+        char row[64];
+        int length = std::snprintf(row, sizeof(row), "%llu,%.4f\n", (unsigned long long)total_frames, ms);
+        csv.write(row, length);
+    }
+}
+
+void FrameStats::clear() {
+    next = 0;
+    count = 0;
+    total_frames = 0;
+    last_tick = -1.0;
+    last_report = -1.0;
+}
+
+FrameSummary FrameStats::summary() const {
+    FrameSummary result;
+    result.frames = count;
+    if (count == 0) {
+        return result;
+    }
+    double sum = 0.0;
+    for (size_t i = 0; i < count; i++) {
+        sum += times[i];
+        result.max = std::max(result.max, times[i]);
+        scratch[i] = times[i];
+    }
+    result.average = sum / count;
+    // Each nth_element leaves the data partitioned, so the later ones have less to move.
+    result.p50 = frame_stats::percentile(scratch, count, 0.50);
+    result.p95 = frame_stats::percentile(scratch, count, 0.95);
+    result.p99 = frame_stats::percentile(scratch, count, 0.99);
+    return result;
+}
+
+std::vector<double> FrameStats::samples() const {
+    std::vector<double> ordered;
+    ordered.reserve(count);
+    size_t first = count < times.size() ? 0 : next;
+    for (size_t i = 0; i < count; i++) {
+        ordered.push_back(times[(first + i) % times.size()]);
+    }
+    return ordered;
+}
+
+bool FrameStats::should_report(double now_seconds, double interval) {
+    if (last_report >= 0.0 && now_seconds - last_report < interval) {
+        return false;
+    }
+    last_report = now_seconds;
+    return true;
+}
+
+std::string FrameStats::format() const {
+    FrameSummary s = summary();
+    char text[160];
+    std::snprintf(text, sizeof(text), "%.1f FPS | avg %.2f ms, p50 %.2f, p95 %.2f, p99 %.2f, max %.2f",
+        s.average > 0.0 ? 1000.0 / s.average : 0.0, s.average, s.p50, s.p95, s.p99, s.max);
+    return text;
+}
+
+void FrameStats::print_summary() const {
+    std::cout << "FRAME_STATS frames " << total_frames << " | " << format() << std::endl;
+}
+
+bool FrameStats::open_csv(const std::string& path) {
+    close_csv();
+    csv.open(path, std::ofstream::trunc);
+    if (!csv) {
+        std::cout << "ERROR::FRAME_STATS::CSV_OPEN_FAILED " << path << std::endl;
+        return false;
+    }
+    csv << "frame,ms\n";
+    return true;
+}
+
+void FrameStats::close_csv() {
+    if (csv.is_open()) {
+        csv.close();
+    }
+}
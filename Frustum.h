@@ -0,0 +1,297 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <Bounds.h>
+
+#include <vector>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define FRUSTUM_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+// MSVC compiles AVX intrinsics without /arch:AVX, it only has to be checked for before they run.
+#define FRUSTUM_TARGET_AVX
+#else
+#define FRUSTUM_TARGET_AVX __attribute__((target("avx")))
+#endif
+#endif
+
+// View frustum as six planes (left, right, bottom, top, near, far) with normals pointing inwards, so a
+// point p is inside when dot(plane.xyz, p) + plane.w >= 0 for all six.
+struct Frustum {
+    glm::vec4 planes[6];
+
+    // Gribb-Hartmann: the planes are sums and differences of the rows of projection * view. Passing
+    // projection * view * model gives the planes in that model's own space.
+    static Frustum from_matrix(const glm::mat4& matrix);
+    // Conservative: a box near a frustum corner can pass without touching the frustum.
+    bool intersects(const AABB& box) const;
+    // True when the whole box is inside.
+    bool contains(const AABB& box) const;
+};
+
+// Boxes stored as six float arrays, so the culling loops load four or eight boxes per instruction. The
+// arrays are padded to a multiple of FRUSTUM_CULL_BATCH with empty boxes.
+const size_t FRUSTUM_CULL_BATCH = 8;
+
+struct AABBList {
+    std::vector<float> min_x, min_y, min_z;
+    std::vector<float> max_x, max_y, max_z;
+    size_t count = 0;
+
+    void clear();
+    void reserve(size_t boxes);
+    void push_back(const AABB& box);
+    void set(size_t i, const AABB& box);
+    AABB get(size_t i) const;
+    size_t size() const { return count; }
+};
+
+namespace frustum {
+    // True when the CPU and OS support AVX, checked once.
+    bool has_avx();
+
+    // Each cull writes visible[i] = 1 or 0 for the count boxes in the list and returns the visible count.
+    size_t cull_scalar(const Frustum& frustum, const AABBList& boxes, uint8_t* visible);
+#ifdef FRUSTUM_X86
+    size_t cull_sse(const Frustum& frustum, const AABBList& boxes, uint8_t* visible);
+    FRUSTUM_TARGET_AVX size_t cull_avx(const Frustum& frustum, const AABBList& boxes, uint8_t* visible);
+#endif
+    // The widest of the above the CPU runs.
+    size_t cull(const Frustum& frustum, const AABBList& boxes, uint8_t* visible);
+}
+
+Frustum Frustum::from_matrix(const glm::mat4& matrix) {
+    // glm is column major, row r of the matrix is (m[0][r], m[1][r], m[2][r], m[3][r]).
+    glm::vec4 row[4];
+    for (int r = 0; r < 4; r++) {
+        row[r] = glm::vec4(matrix[0][r], matrix[1][r], matrix[2][r], matrix[3][r]);
+    }
+    Frustum frustum;
+    frustum.planes[0] = row[3] + row[0];
+    frustum.planes[1] = row[3] - row[0];
+    frustum.planes[2] = row[3] + row[1];
+    frustum.planes[3] = row[3] - row[1];
+    frustum.planes[4] = row[3] + row[2];
+    frustum.planes[5] = row[3] - row[2];
+    for (glm::vec4& plane : frustum.planes) {
+        float length = glm::length(glm::vec3(plane));
+        if (length > 0.0f) {
+            plane /= length;
+        }
+    }
+    return frustum;
+}
+
+bool Frustum::intersects(const AABB& box) const {
+    // The box is outside when its corner furthest along the normal is behind any plane.
+    for (const glm::vec4& plane : planes) {
+        glm::vec3 corner(plane.x > 0.0f ? box.max.x : box.min.x, plane.y > 0.0f ? box.max.y : box.min.y,
+            plane.z > 0.0f ? box.max.z : box.min.z);
+        if (glm::dot(glm::vec3(plane), corner) + plane.w < 0.0f) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Frustum::contains(const AABB& box) const {
+    // Inside when even the corner furthest against each normal is in front of its plane.
+    for (const glm::vec4& plane : planes) {
+        glm::vec3 corner(plane.x > 0.0f ? box.min.x : box.max.x, plane.y > 0.0f ? box.min.y : box.max.y,
+            plane.z > 0.0f ? box.min.z : box.max.z);
+        if (glm::dot(glm::vec3(plane), corner) + plane.w < 0.0f) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void AABBList::clear() {
+    min_x.clear();
+    min_y.clear();
+    min_z.clear();
+    max_x.clear();
+    max_y.clear();
+    max_z.clear();
+    count = 0;
+}
+
+void AABBList::reserve(size_t boxes) {
+    size_t padded = (boxes + FRUSTUM_CULL_BATCH - 1) / FRUSTUM_CULL_BATCH * FRUSTUM_CULL_BATCH;
+    min_x.reserve(padded);
+    min_y.reserve(padded);
+    min_z.reserve(padded);
+    max_x.reserve(padded);
+    max_y.reserve(padded);
+    max_z.reserve(padded);
+}
+
+void AABBList::push_back(const AABB& box) {
+    if (count == min_x.size()) {
+        AABB empty;
+        for (size_t i = 0; i < FRUSTUM_CULL_BATCH; i++) {
+            min_x.push_back(empty.min.x);
+            min_y.push_back(empty.min.y);
+            min_z.push_back(empty.min.z);
+            max_x.push_back(empty.max.x);
+            max_y.push_back(empty.max.y);
+            max_z.push_back(empty.max.z);
+        }
+    }
+    set(count++, box);
+}
+
+void AABBList::set(size_t i, const AABB& box) {
+    min_x[i] = box.min.x;
+    min_y[i] = box.min.y;
+    min_z[i] = box.min.z;
+    max_x[i] = box.max.x;
+    max_y[i] = box.max.y;
+    max_z[i] = box.max.z;
+}
+
+AABB AABBList::get(size_t i) const {
+    AABB box;
+    box.min = glm::vec3(min_x[i], min_y[i], min_z[i]);
+    box.max = glm::vec3(max_x[i], max_y[i], max_z[i]);
+    return box;
+}
+
+namespace frustum {
+    bool has_avx() {
+#ifdef FRUSTUM_X86
+        static const bool supported = [] {
+#if defined(_MSC_VER)
+            int info[4];
+            __cpuid(info, 1);
+            bool osxsave = (info[2] & (1 << 27)) != 0;
+            bool avx = (info[2] & (1 << 28)) != 0;
+            // The OS has to save the YMM registers too.
+            return osxsave && avx && (_xgetbv(0) & 6) == 6;
+#else
+            return __builtin_cpu_supports("avx") != 0;
+#endif
+        }();
+        return supported;
+#else
+        return false;
+#endif
+    }
+
+    size_t cull_scalar(const Frustum& frustum, const AABBList& boxes, uint8_t* visible) {
+        size_t count = 0;
+        for (size_t i = 0; i < boxes.count; i++) {
+            bool inside = true;
+            for (const glm::vec4& plane : frustum.planes) {
+                float x = plane.x > 0.0f ? boxes.max_x[i] : boxes.min_x[i];
+                float y = plane.y > 0.0f ? boxes.max_y[i] : boxes.min_y[i];
+                float z = plane.z > 0.0f ? boxes.max_z[i] : boxes.min_z[i];
+                if (plane.x * x + plane.y * y + plane.z * z + plane.w < 0.0f) {
+                    inside = false;
+                    break;
+                }
+            }
+            visible[i] = inside ? 1 : 0;
+            count += inside ? 1 : 0;
+        }
+        return count;
+    }
+
+#ifdef FRUSTUM_X86
+    // The corner picked per plane only depends on the signs of the plane normal, so it is picked once per
+    // plane by choosing the min or max array, and the box loop itself has no branches.
+    struct PlaneCorner {
+        const float* x;
+        const float* y;
+        const float* z;
+    };
+
+    void plane_corners(const Frustum& frustum, const AABBList& boxes, PlaneCorner* corners) {
+        for (int p = 0; p < 6; p++) {
+            const glm::vec4& plane = frustum.planes[p];
+            corners[p].x = plane.x > 0.0f ? boxes.max_x.data() : boxes.min_x.data();
+            corners[p].y = plane.y > 0.0f ? boxes.max_y.data() : boxes.min_y.data();
+            corners[p].z = plane.z > 0.0f ? boxes.max_z.data() : boxes.min_z.data();
+        }
+    }
+
+    size_t cull_sse(const Frustum& frustum, const AABBList& boxes, uint8_t* visible) {
+        PlaneCorner corners[6];
+        plane_corners(frustum, boxes, corners);
+        __m128 a[6], b[6], c[6], d[6];
+        for (int p = 0; p < 6; p++) {
+            a[p] = _mm_set1_ps(frustum.planes[p].x);
+            b[p] = _mm_set1_ps(frustum.planes[p].y);
+            c[p] = _mm_set1_ps(frustum.planes[p].z);
+            d[p] = _mm_set1_ps(frustum.planes[p].w);
+        }
+        const __m128 zero = _mm_setzero_ps();
+        size_t count = 0;
+        for (size_t i = 0; i < boxes.count; i += 4) {
+            __m128 outside = zero;
+            for (int p = 0; p < 6; p++) {
+                __m128 distance = _mm_add_ps(
+                    _mm_add_ps(_mm_mul_ps(a[p], _mm_loadu_ps(corners[p].x + i)),
+                        _mm_mul_ps(b[p], _mm_loadu_ps(corners[p].y + i))),
+                    _mm_add_ps(_mm_mul_ps(c[p], _mm_loadu_ps(corners[p].z + i)), d[p]));
+                outside = _mm_or_ps(outside, _mm_cmplt_ps(distance, zero));
+            }
+            int mask = ~_mm_movemask_ps(outside);
+            size_t lanes = boxes.count - i < 4 ? boxes.count - i : 4;
+            for (size_t lane = 0; lane < lanes; lane++) {
+                uint8_t inside = (uint8_t)((mask >> lane) & 1);
+                visible[i + lane] = inside;
+                count += inside;
+            }
+        }
+        return count;
+    }
+
+    FRUSTUM_TARGET_AVX size_t cull_avx(const Frustum& frustum, const AABBList& boxes, uint8_t* visible) {
+        PlaneCorner corners[6];
+        plane_corners(frustum, boxes, corners);
+        __m256 a[6], b[6], c[6], d[6];
+        for (int p = 0; p < 6; p++) {
+            a[p] = _mm256_set1_ps(frustum.planes[p].x);
+            b[p] = _mm256_set1_ps(frustum.planes[p].y);
+            c[p] = _mm256_set1_ps(frustum.planes[p].z);
+            d[p] = _mm256_set1_ps(frustum.planes[p].w);
+        }
+        const __m256 zero = _mm256_setzero_ps();
+        size_t count = 0;
+        for (size_t i = 0; i < boxes.count; i += 8) {
+            __m256 outside = zero;
+            for (int p = 0; p < 6; p++) {
+                __m256 distance = _mm256_add_ps(
+                    _mm256_add_ps(_mm256_mul_ps(a[p], _mm256_loadu_ps(corners[p].x + i)),
+                        _mm256_mul_ps(b[p], _mm256_loadu_ps(corners[p].y + i))),
+                    _mm256_add_ps(_mm256_mul_ps(c[p], _mm256_loadu_ps(corners[p].z + i)), d[p]));
+                outside = _mm256_or_ps(outside, _mm256_cmp_ps(distance, zero, _CMP_LT_OQ));
+            }
+            int mask = ~_mm256_movemask_ps(outside);
+            size_t lanes = boxes.count - i < 8 ? boxes.count - i : 8;
+            for (size_t lane = 0; lane < lanes; lane++) {
+                uint8_t inside = (uint8_t)((mask >> lane) & 1);
+                visible[i + lane] = inside;
+                count += inside;
+            }
+        }
+        return count;
+    }
+#endif
+
+    size_t cull(const Frustum& frustum, const AABBList& boxes, uint8_t* visible) {
+#ifdef FRUSTUM_X86
+        if (has_avx()) {
+            return cull_avx(frustum, boxes, visible);
+        }
+        return cull_sse(frustum, boxes, visible);
+#else
+        return cull_scalar(frustum, boxes, visible);
+#endif
+    }
+}
@@ -0,0 +1,202 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+// Texture units whose bindings are tracked, binds to higher units are always issued.
+const unsigned int GL_STATE_TEXTURE_UNITS = 16;
+
+struct GLStateStats {
+    unsigned int issued = 0;
+    unsigned int skipped = 0;
+};
+
+// Shadow copy of the render context's binding and fixed-function state. Program, VAO, texture and
+// depth/blend changes on the render thread go through here, so calls that would not change anything
+// are dropped. Objects deleted while bound must be deleted through here too, otherwise a new object
+// reusing the name could be taken for the old, still bound one.
+//
+// The upload thread has its own context and must not use this.
+class GLState {
+public:
+    static GLState& instance();
+
+    void use_program(unsigned int program);
+    void bind_vertex_array(unsigned int vao);
+    void active_texture(unsigned int unit);
+    // Binds to GL_TEXTURE_2D on unit, switching the active unit only when the binding changes.
+    void bind_texture(unsigned int unit, unsigned int texture);
+    // Makes texture the target of the following GL_TEXTURE_2D calls: unit 0 active, texture bound to it.
+    void edit_texture(unsigned int texture);
+    void set_depth_test(bool enabled);
+    void set_depth_mask(bool enabled);
+    void set_blend(bool enabled);
+    void set_blend_func(GLenum source, GLenum destination);
+
+    void delete_program(unsigned int program);
+    void delete_vertex_array(unsigned int vao);
+    void delete_texture(unsigned int texture);
+    // Forgets everything, for after code that changed state behind our back.
+    void invalidate();
+
+    const GLStateStats& stats() const { return counters; }
+    void reset_stats() { counters = GLStateStats(); }
+private:
+    // Matches no GL name, so the first call after invalidate() is always issued.
+    static const unsigned int UNKNOWN = 0xFFFFFFFF;
+
+    enum Flag {
+        FLAG_UNKNOWN = -1,
+        FLAG_OFF = 0,
+        FLAG_ON = 1
+    };
+
+    unsigned int program = UNKNOWN;
+    unsigned int vao = UNKNOWN;
+    unsigned int unit = UNKNOWN;
+    unsigned int textures[GL_STATE_TEXTURE_UNITS];
+    Flag depth_test = FLAG_UNKNOWN;
+    Flag depth_mask = FLAG_UNKNOWN;
+    Flag blend = FLAG_UNKNOWN;
+    GLenum blend_source = UNKNOWN, blend_destination = UNKNOWN;
+    GLStateStats counters;
+
+    GLState();
+    // Counts the call and says whether it has to be issued.
+    bool changes(unsigned int& current, unsigned int value);
+    bool changes(Flag& current, bool value);
+};
+
+GLState& GLState::instance() {
+    static GLState state;
+    return state;
+}
+
+GLState::GLState() {
+    invalidate();
+}
+
+bool GLState::changes(unsigned int& current, unsigned int value) {
+    if (current == value) {
+        counters.skipped++;
+        return false;
+    }
+    current = value;
+    counters.issued++;
+    return true;
+}
+
+bool GLState::changes(Flag& current, bool value) {
+    Flag flag = value ? FLAG_ON : FLAG_OFF;
+    if (current == flag) {
+        counters.skipped++;
+        return false;
+    }
+    current = flag;
+    counters.issued++;
+    return true;
+}
+
+void GLState::use_program(unsigned int program) {
+    if (changes(this->program, program)) {
+        glUseProgram(program);
+    }
+}
+
+void GLState::bind_vertex_array(unsigned int vao) {
+    if (changes(this->vao, vao)) {
+        glBindVertexArray(vao);
+    }
+}
+
+void GLState::active_texture(unsigned int unit) {
+    if (changes(this->unit, unit)) {
+        glActiveTexture(GL_TEXTURE0 + unit);
+    }
+}
+
+void GLState::bind_texture(unsigned int unit, unsigned int texture) {
+    if (unit >= GL_STATE_TEXTURE_UNITS) {
+        this->unit = unit;
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        counters.issued += 2;
+        return;
+    }
+    if (changes(textures[unit], texture)) {
+        active_texture(unit);
+        glBindTexture(GL_TEXTURE_2D, texture);
+    }
+}
+
+void GLState::edit_texture(unsigned int texture) {
+    active_texture(0);
+    bind_texture(0, texture);
+}
+
+void GLState::set_depth_test(bool enabled) {
+    if (changes(depth_test, enabled)) {
+        enabled ? glEnable(GL_DEPTH_TEST) : glDisable(GL_DEPTH_TEST);
+    }
+}
+
+void GLState::set_depth_mask(bool enabled) {
+    if (changes(depth_mask, enabled)) {
+        glDepthMask(enabled ? GL_TRUE : GL_FALSE);
+    }
+}
+
+void GLState::set_blend(bool enabled) {
+    if (changes(blend, enabled)) {
+        enabled ? glEnable(GL_BLEND) : glDisable(GL_BLEND);
+    }
+}
+
+void GLState::set_blend_func(GLenum source, GLenum destination) {
+    if (blend_source == source && blend_destination == destination) {
+        counters.skipped++;
+        return;
+    }
+    blend_source = source;
+    blend_destination = destination;
+    counters.issued++;
+    glBlendFunc(source, destination);
+}
+
+void GLState::delete_program(unsigned int program) {
+    glDeleteProgram(program);
+    // The current program is only flagged for deletion, so a later glUseProgram(0) must not be skipped.
+    if (this->program == program) {
+        this->program = UNKNOWN;
+    }
+}
+
+void GLState::delete_vertex_array(unsigned int vao) {
+    glDeleteVertexArrays(1, &vao);
+    if (this->vao == vao) {
+        this->vao = 0;
+    }
+}
+
+void GLState::delete_texture(unsigned int texture) {
+    glDeleteTextures(1, &texture);
+    // GL unbinds a deleted texture from every unit of the current context.
+    for (unsigned int& bound : textures) {
+        if (bound == texture) {
+            bound = 0;
+        }
+    }
+}
+
+void GLState::invalidate() {
+    program = UNKNOWN;
+    vao = UNKNOWN;
+    unit = UNKNOWN;
+    for (unsigned int& bound : textures) {
+        bound = UNKNOWN;
+    }
+    depth_test = FLAG_UNKNOWN;
+    depth_mask = FLAG_UNKNOWN;
+    blend = FLAG_UNKNOWN;
+    blend_source = blend_destination = UNKNOWN;
+}
@@ -0,0 +1,254 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <Shader.h>
+#include <GLState.h>
+#include <Bounds.h>
+#include <Trace.h>
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cmath>
+
+// Frames between occlusion tests of an object that is visible. Each object is offset by its id, so the
+// tests of a scene are spread over the frames.
+const uint64_t OCCLUSION_QUERY_INTERVAL = 8;
+
+struct OcclusionQueryStats {
+    unsigned int queries = 0;
+    // Objects drawn as they were visible last time they were tested.
+    unsigned int visible_draws = 0;
+    // Draws of hidden objects submitted under a conditional render.
+    unsigned int conditional_draws = 0;
+    // Conditional draws the GPU skipped, counted when their query comes back, a few frames after the draw.
+    unsigned int saved_draws = 0;
+    size_t saved_triangles = 0;
+};
+
+// GPU occlusion culling with GL_ANY_SAMPLES_PASSED queries, after coherent hierarchical culling
+// (CHC++). Visibility is assumed to carry over from the last test:
+//  - objects visible then are drawn straight away, and every OCCLUSION_QUERY_INTERVAL frames the draw
+//    itself is wrapped in a query to see whether they still are;
+//  - objects hidden then have their bounding box drawn into the depth the visible ones left, with color
+//    and depth writes off, inside a query. The object is drawn under glBeginConditionalRender on that
+//    query, so the GPU drops the draw when no sample of the box passed.
+// Results are only read once GL_QUERY_RESULT_AVAILABLE says so, the CPU never waits on the GPU. Each
+// object has one query object, it has at most one query in flight.
+class OcclusionQueries {
+public:
+    OcclusionQueries(const std::string& vertex_path, const std::string& fragment_path);
+    ~OcclusionQueries();
+    OcclusionQueries(const OcclusionQueries&) = delete;
+    OcclusionQueries& operator=(const OcclusionQueries&) = delete;
+
+    // Uniform blocks such as the camera have to be attached by the caller.
+    Shader& get_shader() { return shader; }
+
+    // Draws count objects, draw(k) submitting the k-th. ids identify the objects across frames, boxes are
+    // their world bounds and triangles their size for the stats. eye and projection are the camera's,
+    // a glm::perspective projection: a box the near plane may cut into is drawn without a test, its
+    // front faces could be clipped away.
+    template<typename Draw>
+    void render(size_t count, const uint32_t* ids, const AABB* boxes, const size_t* triangles,
+        const glm::vec3& eye, const glm::mat4& projection, Draw draw);
+    // Counts of the last render().
+    const OcclusionQueryStats& stats() const { return counters; }
+private:
+    struct Object {
+        unsigned int query = 0;
+        bool visible = true;
+        bool pending = false;
+        // Conditional draws made on the pending query.
+        unsigned int conditional_draws = 0;
+        uint64_t next_test = 0;
+        size_t triangles = 0;
+    };
+
+    Shader shader;
+    Uniform<glm::mat4> box_uniform;
+    unsigned int VAO = 0, VBO = 0, EBO = 0;
+    std::vector<Object> objects;
+    uint64_t frame = 0;
+    OcclusionQueryStats counters;
+    // Per render(): objects of the hidden pass.
+    std::vector<size_t> hidden;
+
+    Object& object(uint32_t id);
+    static float near_plane_reach(const glm::mat4& projection);
+    void collect();
+    void draw_box(const AABB& box);
+};
+
+OcclusionQueries::OcclusionQueries(const std::string& vertex_path, const std::string& fragment_path)
+    : shader(vertex_path, fragment_path) {
+    box_uniform = shader.uniform<glm::mat4>("box");
+
+    // Unit cube, scaled and moved onto each box by the box uniform.
+    float vertices[24];
+    for (int i = 0; i < 8; i++) {
+        vertices[i * 3 + 0] = (float)(i & 1);
+        vertices[i * 3 + 1] = (float)((i >> 1) & 1);
+        vertices[i * 3 + 2] = (float)((i >> 2) & 1);
+    }
+    const unsigned int indices[36] = { 0, 1, 3, 0, 3, 2, 4, 6, 7, 4, 7, 5, 0, 4, 5, 0, 5, 1,
+        2, 3, 7, 2, 7, 6, 0, 2, 6, 0, 6, 4, 1, 5, 7, 1, 7, 3 };
+    glGenVertexArrays(1, &VAO);
+    glGenBuffers(1, &VBO);
+    glGenBuffers(1, &EBO);
+    GLState::instance().bind_vertex_array(VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+    GLState::instance().bind_vertex_array(0);
+}
+
+OcclusionQueries::~OcclusionQueries() {
+    if (glfwGetCurrentContext() == nullptr) {
+        return;
+    }
+    for (const Object& object : objects) {
+        if (object.query != 0) {
+            glDeleteQueries(1, &object.query);
+        }
+    }
+    GLState::instance().delete_vertex_array(VAO);
+    glDeleteBuffers(1, &VBO);
+    glDeleteBuffers(1, &EBO);
+}
+
+OcclusionQueries::Object& OcclusionQueries::object(uint32_t id) {
+    while (objects.size() <= id) {
+        Object added;
+        glGenQueries(1, &added.query);
+        // Tested soon, but not all in the same frame.
+        added.next_test = frame + 1 + objects.size() % OCCLUSION_QUERY_INTERVAL;
+        objects.push_back(added);
+    }
+    return objects[id];
+}
+
+void OcclusionQueries::collect() {
+    for (Object& object : objects) {
+        if (!object.pending) {
+            continue;
+        }
+        int available = 0;
+        glGetQueryObjectiv(object.query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) {
+            continue;
+        }
+        unsigned int passed = 0;
+        glGetQueryObjectuiv(object.query, GL_QUERY_RESULT, &passed);
+        object.pending = false;
+        if (!passed) {
+            counters.saved_draws += object.conditional_draws;
+            counters.saved_triangles += object.conditional_draws * object.triangles;
+        }
+        if (passed && !object.visible) {
+            object.next_test = frame + OCCLUSION_QUERY_INTERVAL;
+        }
+        object.visible = passed != 0;
+        object.conditional_draws = 0;
+    }
+}
+
+// Distance from the eye to the corners of the near plane rectangle, the farthest any of it gets: the
+// near distance over the cosine of the half diagonal field of view. All three come from the matrix, so
+// they can't drift from what the frame was rendered with.
+float OcclusionQueries::near_plane_reach(const glm::mat4& projection) {
+    float near_plane = projection[3][2] / (projection[2][2] - 1.0f);
+    float tan_x = 1.0f / projection[0][0];
+    float tan_y = 1.0f / projection[1][1];
+    return near_plane * std::sqrt(1.0f + tan_x * tan_x + tan_y * tan_y);
+}
+
+void OcclusionQueries::draw_box(const AABB& box) {
+    glm::mat4 transform = glm::translate(glm::mat4(1.0f), box.min);
+    transform = glm::scale(transform, box.max - box.min);
+    shader.set(box_uniform, transform);
+    glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, (void*)0);
+}
+
+template<typename Draw>
+void OcclusionQueries::render(size_t count, const uint32_t* ids, const AABB* boxes, const size_t* triangles,
+    const glm::vec3& eye, const glm::mat4& projection, Draw draw) {
+    TRACE_SCOPE("OcclusionQueries::render");
+    frame++;
+    counters = OcclusionQueryStats();
+    collect();
+    // Any box within this of the eye on every axis may touch the near plane rectangle.
+    float reach_distance = near_plane_reach(projection);
+
+    // Visible objects first, they are the occluders the hidden ones are tested against.
+    hidden.clear();
+    for (size_t k = 0; k < count; k++) {
+        Object& o = object(ids[k]);
+        o.triangles = triangles[k];
+        AABB reach = boxes[k];
+        reach.min -= glm::vec3(reach_distance);
+        reach.max += glm::vec3(reach_distance);
+        bool eye_inside = glm::all(glm::greaterThanEqual(eye, reach.min)) && glm::all(glm::lessThanEqual(eye, reach.max));
+        if (!o.visible && !eye_inside) {
+            hidden.push_back(k);
+            continue;
+        }
+        counters.visible_draws++;
+        if (o.pending || eye_inside || frame < o.next_test) {
+            draw(k);
+            continue;
+        }
+        glBeginQuery(GL_ANY_SAMPLES_PASSED, o.query);
+        draw(k);
+        glEndQuery(GL_ANY_SAMPLES_PASSED);
+        o.pending = true;
+        o.next_test = frame + OCCLUSION_QUERY_INTERVAL;
+        counters.queries++;
+    }
+    if (hidden.empty()) {
+        return;
+    }
+
+    // Boxes of the hidden objects that have no query in flight, all in one state change.
+    GLState& state = GLState::instance();
+    bool boxes_started = false;
+    for (size_t k : hidden) {
+        Object& o = objects[ids[k]];
+        if (o.pending) {
+            continue;
+        }
+        if (!boxes_started) {
+            state.use_program(shader.ID);
+            state.bind_vertex_array(VAO);
+            state.set_depth_mask(false);
+            glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+            boxes_started = true;
+        }
+        glBeginQuery(GL_ANY_SAMPLES_PASSED, o.query);
+        draw_box(boxes[k]);
+        glEndQuery(GL_ANY_SAMPLES_PASSED);
+        o.pending = true;
+        counters.queries++;
+    }
+    if (boxes_started) {
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        state.set_depth_mask(true);
+    }
+
+    // GL_QUERY_WAIT makes the GPU, not the CPU, wait for the box result before deciding.
+    for (size_t k : hidden) {
+        Object& o = objects[ids[k]];
+        glBeginConditionalRender(o.query, GL_QUERY_WAIT);
+        draw(k);
+        glEndConditionalRender();
+        o.conditional_draws++;
+        counters.conditional_draws++;
+    }
+}
@@ -0,0 +1,253 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+#include <iostream>
+
+// Frames of queries in flight. A frame's results are read back when its slot comes round again,
+// by then the GPU has long finished it and reading never waits.
+const int GPU_PROFILER_FRAMES = 4;
+
+struct GpuScopeResult {
+    std::string name;
+    // -1 unless the scope was pushed with an index, e.g. the submesh of a per-draw scope.
+    int index;
+    // 0 for the frame itself, 1 for the scopes directly inside it and so on.
+    int depth;
+    double ms;
+};
+
+// GPU time of named scopes, measured with a GL_TIMESTAMP query at each end. Timestamps instead of
+// GL_TIME_ELAPSED because elapsed queries can't nest. Each frame in flight has its own pool of query
+// objects, grown on demand and then reused, and its results are read GPU_PROFILER_FRAMES frames later.
+// A frame whose results still aren't in by then is dropped rather than waited for.
+//
+// Per-draw mode adds a scope around every Model draw and every submesh or draw group inside it. That
+// many queries perturb the timings themselves, so it is off unless asked for.
+class GpuProfiler {
+public:
+    static GpuProfiler& instance();
+
+    void set_enabled(bool enabled) { this->enabled = enabled; }
+    bool is_enabled() const { return enabled; }
+    void set_per_draw(bool per_draw) { this->per_draw = per_draw; }
+    bool is_per_draw() const { return enabled && per_draw; }
+
+    // Collects the frame issued GPU_PROFILER_FRAMES frames ago and opens the frame scope. True when
+    // that frame's results came in and results() changed.
+    bool begin_frame();
+    void end_frame();
+    // name is copied into storage reused across frames.
+    void push(const char* name, int index = -1);
+    void pop();
+
+    // Scopes of the most recent frame whose results are in, in the order they were opened.
+    const std::vector<GpuScopeResult>& results() const { return latest; }
+    // GPU time of the most recent collected frame, 0 before the first one is in.
+    double frame_ms() const { return latest.empty() ? 0.0 : latest[0].ms; }
+    size_t dropped_frames() const { return dropped; }
+    // "name ms" for every scope down to max_depth.
+    std::string format(int max_depth = 1) const;
+    void print() const;
+    // Deletes the queries, call while the context is still current.
+    void release();
+private:
+    struct Scope {
+        std::string name;
+        int index;
+        int depth;
+        size_t begin_query;
+        size_t end_query;
+    };
+
+    struct Frame {
+        std::vector<unsigned int> queries;
+        size_t used = 0;
+        // Entries past scope_count are left from earlier frames and reused, names keep their storage.
+        std::vector<Scope> scopes;
+        size_t scope_count = 0;
+        std::vector<size_t> open;
+        bool pending = false;
+    };
+
+    bool enabled = true;
+    bool per_draw = false;
+    bool in_frame = false;
+    Frame frames[GPU_PROFILER_FRAMES];
+    uint64_t frame_index = 0;
+    size_t dropped = 0;
+    std::vector<GpuScopeResult> latest;
+
+    GpuProfiler() = default;
+    Frame& current() { return frames[frame_index % GPU_PROFILER_FRAMES]; }
+    size_t timestamp(Frame& frame);
+    bool collect(Frame& frame);
+};
+
+// Times the enclosing block. Inactive scopes cost one branch, so per-draw scopes can stay in the code.
+class GpuScope {
+public:
+    GpuScope(const char* name, bool active = true, int index = -1);
+    ~GpuScope();
+    GpuScope(const GpuScope&) = delete;
+    GpuScope& operator=(const GpuScope&) = delete;
+private:
+    bool active;
+};
+
+GpuProfiler& GpuProfiler::instance() {
+    static GpuProfiler profiler;
+    return profiler;
+}
+
+size_t GpuProfiler::timestamp(Frame& frame) {
+    if (frame.used == frame.queries.size()) {
+        unsigned int query;
+        glGenQueries(1, &query);
+        frame.queries.push_back(query);
+    }
+    glQueryCounter(frame.queries[frame.used], GL_TIMESTAMP);
+    return frame.used++;
+}
+
+bool GpuProfiler::collect(Frame& frame) {
+    frame.pending = false;
+    if (frame.scope_count == 0 || frame.used == 0) {
+        return false;
+    }
+    // Queries finish in submission order, once the frame's last one is in they all are.
+    int available = 0;
+    glGetQueryObjectiv(frame.queries[frame.used - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available) {
+        dropped++;
+        return false;
+    }
+    latest.resize(frame.scope_count);
+    for (size_t i = 0; i < frame.scope_count; i++) {
+        const Scope& scope = frame.scopes[i];
+        GLuint64 begin = 0, end = 0;
+        glGetQueryObjectui64v(frame.queries[scope.begin_query], GL_QUERY_RESULT, &begin);
+        glGetQueryObjectui64v(frame.queries[scope.end_query], GL_QUERY_RESULT, &end);
+        latest[i].name = scope.name;
+        latest[i].index = scope.index;
+        latest[i].depth = scope.depth;
+        latest[i].ms = end > begin ? (end - begin) / 1e6 : 0.0;
+    }
+    return true;
+}
+
+bool GpuProfiler::begin_frame() {
+    if (!enabled) {
+        return false;
+    }
+    Frame& frame = current();
+    bool collected = frame.pending && collect(frame);
+    frame.used = 0;
+    frame.scope_count = 0;
+    frame.open.clear();
+    in_frame = true;
+    push("frame");
+    return collected;
+}
+
+void GpuProfiler::end_frame() {
+    if (!enabled || !in_frame) {
+        return;
+    }
+    Frame& frame = current();
+    while (!frame.open.empty()) {
+        pop();
+    }
+    frame.pending = true;
+    in_frame = false;
+    frame_index++;
+}
+
+void GpuProfiler::push(const char* name, int index) {
+    if (!enabled || !in_frame) {
+        return;
+    }
+    Frame& frame = current();
+    if (frame.scope_count == frame.scopes.size()) {
+        frame.scopes.push_back(Scope());
+    }
+    Scope& scope = frame.scopes[frame.scope_count++];
+    scope.name = name;
+    scope.index = index;
+    scope.depth = (int)frame.open.size();
+    scope.begin_query = timestamp(frame);
+    scope.end_query = scope.begin_query;
+    frame.open.push_back(frame.scope_count - 1);
+}
+
+void GpuProfiler::pop() {
+    if (!enabled || !in_frame) {
+        return;
+    }
+    Frame& frame = current();
+    if (frame.open.empty()) {
+        std::cout << "ERROR::GPU_PROFILER::UNBALANCED_POP" << std::endl;
+        return;
+    }
+    frame.scopes[frame.open.back()].end_query = timestamp(frame);
+    frame.open.pop_back();
+}
+
+std::string GpuProfiler::format(int max_depth) const {
+    std::string text;
+    char entry[128];
+    for (const GpuScopeResult& result : latest) {
+        if (result.depth > max_depth) {
+            continue;
+        }
+        if (result.index >= 0) {
+            std::snprintf(entry, sizeof(entry), "%s%s#%d %.2f ms", text.empty() ? "" : ", ", result.name.c_str(),
+                result.index, result.ms);
+        }
+        else {
+            std::snprintf(entry, sizeof(entry), "%s%s %.2f ms", text.empty() ? "" : ", ", result.name.c_str(),
+                result.ms);
+        }
+        text += entry;
+    }
+    return text;
+}
+
+void GpuProfiler::print() const {
+    std::cout << "GPU_PROFILER dropped frames " << dropped << std::endl;
+    for (const GpuScopeResult& result : latest) {
+        std::cout << std::string(result.depth * 2, ' ') << result.name;
+        if (result.index >= 0) {
+            std::cout << "#" << result.index;
+        }
+        std::cout << " " << result.ms << " ms" << std::endl;
+    }
+}
+
+void GpuProfiler::release() {
+    for (Frame& frame : frames) {
+        if (!frame.queries.empty()) {
+            glDeleteQueries((GLsizei)frame.queries.size(), frame.queries.data());
+        }
+        frame = Frame();
+    }
+    in_frame = false;
+}
+
+GpuScope::GpuScope(const char* name, bool active, int index) {
+    this->active = active;
+    if (active) {
+        GpuProfiler::instance().push(name, index);
+    }
+}
+
+GpuScope::~GpuScope() {
+    if (active) {
+        GpuProfiler::instance().pop();
+    }
+}
@@ -7,6 +7,10 @@
 #include <glm/gtc/type_ptr.hpp>
 
 #include <Shader.h>
+#include <GLState.h>
+#include <ShaderVariants.h>
+#include <TextureCache.h>
+#include <InstanceBuffer.h>
 
 #include <vector>
 #include <string>
@@ -29,6 +33,65 @@ struct Texture {
 	unsigned int id;
 	TextureType type;
 	std::string path;
+	TextureHandle handle;
+};
+
+// GL calls issued by Mesh and Model draws. Reset by the caller once per frame.
+struct DrawStats {
+	unsigned int draw_calls = 0;
+	unsigned int vao_binds = 0;
+	unsigned int texture_binds = 0;
+	size_t triangles = 0;
+	// Draws left out because their program was still compiling.
+	unsigned int skipped_draws = 0;
+	// Submeshes and instances that passed or failed frustum culling.
+	unsigned int visible_meshes = 0;
+	unsigned int culled_meshes = 0;
+	// Submeshes and instances inside the frustum but behind occluders.
+	unsigned int occluded_meshes = 0;
+};
+
+DrawStats draw_stats;
+
+// A submesh inside vertex and index buffers shared by a whole model.
+struct MeshRange {
+	unsigned int VAO;
+	size_t first_index;
+	size_t index_count;
+	int base_vertex;
+};
+
+unsigned int create_vertex_array(unsigned int VBO, unsigned int EBO);
+
+// A mesh's textures resolved to the units their samplers read from, once when the mesh is created.
+// Every program has its material samplers pointed at fixed units (assign_units), so binding a
+// material is a walk over a short array: no strings, no uniform lookups, no allocations.
+class Material {
+public:
+	Material() = default;
+	Material(const std::vector<Texture>& textures);
+
+	// Points each material sampler of the program at its fixed unit. Once per program, after linking.
+	static void assign_units(Shader& shader);
+	// Recorded on the set, so variants built later get the units too.
+	static void assign_units(ShaderVariants& variants);
+
+	// Binds the textures and empties the material units this material leaves unused.
+	bool bind() const;
+	// Texture counts as shader_features bits.
+	uint32_t features() const { return feature_bits; }
+private:
+	struct Binding {
+		unsigned int unit;
+		unsigned int id;
+		// The handle's id changes when the upload thread replaces the placeholder.
+		TextureHandle handle;
+	};
+
+	std::vector<Binding> bindings;
+	uint32_t used_units = 0;
+	uint32_t feature_bits = 0;
+	bool valid = true;
 };
 
 class Mesh {
@@ -39,34 +102,107 @@ public:
 
 	Mesh(std::vector<Vertex> vertices, std::vector<unsigned int> indices,
 		std::vector<Texture> textures);
+	// Uploads straight from caller owned memory such as a mapped mesh cache,
+	// vertices and indices are left empty.
+	Mesh(const Vertex* vertices, size_t vertex_count, const unsigned int* indices,
+		size_t index_count, std::vector<Texture> textures);
+	// Adopts buffers filled on the upload thread, only the VAO is created here.
+	Mesh(unsigned int VBO, unsigned int EBO, size_t index_count, std::vector<Texture> textures);
+	// Draws a range of merged buffers owned by the model, no GL objects are created.
+	Mesh(const MeshRange& range, std::vector<Texture> textures);
 
 	void draw(Shader& shader);
+	// One instanced draw, the shader reads its per-instance data from instances.
+	void draw_instanced(Shader& shader, InstanceBuffer& instances);
+	bool bind_textures(Shader& shader);
+	// Issues the draw only, the VAO must already be bound.
+	void draw_elements();
+	void draw_elements_instanced(size_t instance_count);
+	bool same_textures(const Mesh& other) const;
+	// Texture counts of this mesh as shader_features bits, selects the variant that samples only those.
+	uint32_t features() const;
+	MeshRange range() const { return { VAO, first_index, index_count, base_vertex }; }
+	const Material& get_material() const { return material; }
 private:
+	Material material;
 	unsigned int VBO, VAO, EBO;
+	unsigned int index_count;
+	size_t first_index = 0;
+	int base_vertex = 0;
+	// Instance buffer whose attributes the VAO currently points at.
+	unsigned int attached_instances = 0;
 
-	void setup();
+	void setup(const Vertex* vertices, size_t vertex_count, const unsigned int* indices,
+		size_t index_count);
+	void setup_vertex_array();
 };
 
 Mesh::Mesh(std::vector<Vertex> vertices, std::vector<unsigned int> indices,
 	std::vector<Texture> textures) {
-	this->vertices = vertices;
-	this->indices = indices;
+	this->vertices = std::move(vertices);
+	this->indices = std::move(indices);
 	this->textures = textures;
+	material = Material(this->textures);
 
-	setup();
+	setup(this->vertices.data(), this->vertices.size(), this->indices.data(), this->indices.size());
 }
 
-void Mesh::setup() {
-	glGenVertexArrays(1, &VAO);
-	glBindVertexArray(VAO);
+Mesh::Mesh(const Vertex* vertices, size_t vertex_count, const unsigned int* indices,
+	size_t index_count, std::vector<Texture> textures) {
+	this->textures = textures;
+	material = Material(this->textures);
+
+	setup(vertices, vertex_count, indices, index_count);
+}
+
+Mesh::Mesh(unsigned int VBO, unsigned int EBO, size_t index_count, std::vector<Texture> textures) {
+	this->textures = textures;
+	material = Material(this->textures);
+	this->VBO = VBO;
+	this->EBO = EBO;
+	this->index_count = (unsigned int)index_count;
+
+	setup_vertex_array();
+}
+
+Mesh::Mesh(const MeshRange& range, std::vector<Texture> textures) {
+	this->textures = textures;
+	material = Material(this->textures);
+	this->VBO = 0;
+	this->EBO = 0;
+	this->VAO = range.VAO;
+	this->index_count = (unsigned int)range.index_count;
+	this->first_index = range.first_index;
+	this->base_vertex = range.base_vertex;
+}
+
+void Mesh::setup(const Vertex* vertices, size_t vertex_count, const unsigned int* indices,
+	size_t index_count) {
+	this->index_count = (unsigned int)index_count;
 
 	glGenBuffers(1, &EBO);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, EBO);
+	glBufferData(GL_COPY_WRITE_BUFFER, index_count * sizeof(unsigned int), indices, GL_STATIC_DRAW);
 
 	glGenBuffers(1, &VBO);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, VBO);
+	glBufferData(GL_COPY_WRITE_BUFFER, vertex_count * sizeof(Vertex), vertices, GL_STATIC_DRAW);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+	setup_vertex_array();
+}
+
+void Mesh::setup_vertex_array() {
+	VAO = create_vertex_array(VBO, EBO);
+}
+
+unsigned int create_vertex_array(unsigned int VBO, unsigned int EBO) {
+	unsigned int VAO;
+	glGenVertexArrays(1, &VAO);
+	GLState::instance().bind_vertex_array(VAO);
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
 	glBindBuffer(GL_ARRAY_BUFFER, VBO);
-	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
 
 	glEnableVertexAttribArray(0);
 	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0); // Position
@@ -77,41 +213,145 @@ void Mesh::setup() {
 	glEnableVertexAttribArray(2);
 	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords)); // TexCoords
 
-	glBindVertexArray(0);
+	GLState::instance().bind_vertex_array(0);
+	return VAO;
+}
+
+// Sampler uniform names by texture type and index, built once instead of on every draw.
+// Past the shader's three samplers per type the name is empty, which matches no uniform.
+const std::string& material_sampler_name(TextureType type, int index) {
+	static const std::string none;
+	static const std::vector<std::string> names = []() {
+		const char* prefixes[TextureType::TOTAL] = { "material.diffuse[", "material.specular[", "material.emission[" };
+		std::vector<std::string> names;
+		for (int type = 0; type < TextureType::TOTAL; type++) {
+			for (int i = 0; i < 3; i++) {
+				names.push_back(prefixes[type] + std::to_string(i) + "]");
+			}
+		}
+		return names;
+	}();
+	return index < 3 ? names[type * 3 + index] : none;
+}
+
+// material.diffuse[0..2] on units 0-2, material.specular[0..2] on 3-5, material.emission[0..2] on 6-8
+const unsigned int MATERIAL_TEXTURE_UNITS = 9;
+
+unsigned int material_sampler_unit(TextureType type, int index) {
+	return type * 3 + index;
 }
 
-// material.diffuse[1..3] material.specular[1..3] material.emission[1..3]
-void clearActiveTextures() {
-	for (int i = 0; i < 9; i++) {
-		glActiveTexture(GL_TEXTURE0 + i);
-		glBindTexture(GL_TEXTURE_2D, 0);
+Material::Material(const std::vector<Texture>& textures) {
+	int counts[TextureType::TOTAL] = {};
+	for (const Texture& texture : textures) {
+		if (texture.type >= TextureType::TOTAL) {
+			std::cout << "ERROR::MESH::TEXTURE::INVALID_TYPE" << std::endl;
+			valid = false;
+			continue;
+		}
+		// Past the shader's three samplers per type a texture has no unit to go to.
+		if (counts[texture.type] >= 3) {
+			counts[texture.type]++;
+			continue;
+		}
+		unsigned int unit = material_sampler_unit(texture.type, counts[texture.type]++);
+		bindings.push_back({ unit, texture.id, texture.handle });
+		used_units |= 1u << unit;
 	}
+	feature_bits = shader_features::material(counts[TextureType::DIFFUSE], counts[TextureType::SPECULAR],
+		counts[TextureType::EMISSION]);
 }
 
-void Mesh::draw(Shader& shader) {
-	int diffuse_sam = 0, specular_sam = 0, emission_sam = 0;
-	clearActiveTextures();
+void Material::assign_units(Shader& shader) {
 	shader.use();
-	for (int i = 0; i < textures.size(); i++) {
-		glActiveTexture(GL_TEXTURE0 + i);
-		if(textures[i].type == TextureType::DIFFUSE) {
-			shader.setInt(("material.diffuse[" + std::to_string(diffuse_sam++) + "]").c_str(),
-				textures[i].id);
-		} else if (textures[i].type == TextureType::SPECULAR) {
-			shader.setInt(("material.specular[" + std::to_string(specular_sam++) + "]").c_str(), 
-				textures[i].id);
-		} else if (textures[i].type == TextureType::EMISSION) {
-			shader.setInt(("material.emission[" + std::to_string(emission_sam++) + "]").c_str(), 
-				textures[i].id);
-		} else {
-			std::cout << "ERROR::MESH::TEXTURE::INVALID_TYPE" << std::endl;
-			return;
+	for (int type = 0; type < TextureType::TOTAL; type++) {
+		for (int i = 0; i < 3; i++) {
+			shader.setInt(material_sampler_name((TextureType)type, i), material_sampler_unit((TextureType)type, i));
+		}
+	}
+}
+
+void Material::assign_units(ShaderVariants& variants) {
+	for (int type = 0; type < TextureType::TOTAL; type++) {
+		for (int i = 0; i < 3; i++) {
+			variants.setInt(material_sampler_name((TextureType)type, i), material_sampler_unit((TextureType)type, i));
+		}
+	}
+}
+
+bool Material::bind() const {
+	if (!valid) {
+		return false;
+	}
+	GLState& state = GLState::instance();
+	for (const Binding& binding : bindings) {
+		state.bind_texture(binding.unit, binding.handle ? binding.handle->id : binding.id);
+		draw_stats.texture_binds++;
+	}
+	// Samplers of the plain program still read the units this material leaves out, keep them empty.
+	// Once they are, GLState skips these.
+	for (unsigned int unit = 0; unit < MATERIAL_TEXTURE_UNITS; unit++) {
+		if ((used_units & 1u << unit) == 0) {
+			state.bind_texture(unit, 0);
+		}
+	}
+	return true;
+}
+
+void Mesh::draw(Shader& shader) {
+	if (!bind_textures(shader)) {
+		return;
+	}
+	GLState::instance().bind_vertex_array(VAO);
+	draw_stats.vao_binds++;
+	draw_elements();
+}
+
+void Mesh::draw_instanced(Shader& shader, InstanceBuffer& instances) {
+	if (instances.count() == 0 || !bind_textures(shader)) {
+		return;
+	}
+	GLState::instance().bind_vertex_array(VAO);
+	draw_stats.vao_binds++;
+	if (attached_instances != instances.id()) {
+		instances.bind_attributes();
+		attached_instances = instances.id();
+	}
+	draw_elements_instanced(instances.count());
+}
+
+void Mesh::draw_elements_instanced(size_t instance_count) {
+	glDrawElementsInstancedBaseVertex(GL_TRIANGLES, index_count, GL_UNSIGNED_INT,
+		(void*)(first_index * sizeof(unsigned int)), (GLsizei)instance_count, base_vertex);
+	draw_stats.draw_calls++;
+	draw_stats.triangles += index_count / 3 * instance_count;
+}
+
+void Mesh::draw_elements() {
+	glDrawElementsBaseVertex(GL_TRIANGLES, index_count, GL_UNSIGNED_INT,
+		(void*)(first_index * sizeof(unsigned int)), base_vertex);
+	draw_stats.draw_calls++;
+	draw_stats.triangles += index_count / 3;
+}
+
+uint32_t Mesh::features() const {
+	return material.features();
+}
+
+bool Mesh::same_textures(const Mesh& other) const {
+	if (textures.size() != other.textures.size()) {
+		return false;
+	}
+	for (size_t i = 0; i < textures.size(); i++) {
+		if (textures[i].type != other.textures[i].type || textures[i].handle != other.textures[i].handle ||
+			textures[i].id != other.textures[i].id) {
+			return false;
 		}
-		glBindTexture(GL_TEXTURE_2D, textures[i].id);
 	}
-	glActiveTexture(GL_TEXTURE0);
+	return true;
+}
 
-	glBindVertexArray(VAO);
-	glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
-	glBindVertexArray(0);
+bool Mesh::bind_textures(Shader& shader) {
+	shader.use();
+	return material.bind();
 }
\ No newline at end of file
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cstddef>
+
+// Vertex attributes 0-2 come from the mesh, per-instance attributes start here.
+const unsigned int INSTANCE_ATTRIBUTE_LOCATION = 3;
+
+// Per-instance data of the INSTANCED lit variants: the model matrix at location 3 (3-6) and its normal
+// matrix at location 7 (7-9), computed here once per instance rather than per vertex in the shader.
+struct LitInstance {
+    glm::mat4 model;
+    glm::mat3 normal_matrix;
+
+    static LitInstance make(const glm::mat4& model) {
+        return { model, glm::mat3(glm::transpose(glm::inverse(model))) };
+    }
+};
+
+struct InstanceAttribute {
+    unsigned int location;
+    int components;
+    size_t offset;
+};
+
+// Per-instance data for Model::draw_instanced: an array of caller defined structs of floats, each
+// attribute advancing once per instance. The shaders read a mat4 model matrix at location 3
+// (locations 3-6), anything after that is up to the caller, e.g. LitInstance's normal matrix.
+class InstanceBuffer {
+public:
+    InstanceBuffer(size_t stride);
+    ~InstanceBuffer();
+    InstanceBuffer(const InstanceBuffer&) = delete;
+    InstanceBuffer& operator=(const InstanceBuffer&) = delete;
+
+    void add_attribute(unsigned int location, int components, size_t offset);
+    // A mat4 takes four consecutive locations, one per column.
+    void add_mat4(unsigned int location, size_t offset);
+    // A mat3 takes three, its columns are tightly packed vec3s.
+    void add_mat3(unsigned int location, size_t offset);
+    // Replaces the contents. The old storage is orphaned so draws still reading it don't stall us.
+    void update(const void* instances, size_t count);
+    // Points the attributes at this buffer in the bound VAO.
+    void bind_attributes() const;
+
+    unsigned int id() const { return buffer; }
+    size_t count() const { return instance_count; }
+private:
+    unsigned int buffer = 0;
+    size_t stride;
+    size_t instance_count = 0;
+    size_t capacity = 0;
+    std::vector<InstanceAttribute> attributes;
+};
+
+InstanceBuffer::InstanceBuffer(size_t stride) {
+    this->stride = stride;
+    glGenBuffers(1, &buffer);
+}
+
+InstanceBuffer::~InstanceBuffer() {
+    if (buffer != 0 && glfwGetCurrentContext() != nullptr) {
+        glDeleteBuffers(1, &buffer);
+    }
+}
+
+void InstanceBuffer::add_attribute(unsigned int location, int components, size_t offset) {
+    attributes.push_back({ location, components, offset });
+}
+
+void InstanceBuffer::add_mat4(unsigned int location, size_t offset) {
+    for (unsigned int i = 0; i < 4; i++) {
+        add_attribute(location + i, 4, offset + i * 4 * sizeof(float));
+    }
+}
+
+void InstanceBuffer::add_mat3(unsigned int location, size_t offset) {
+    for (unsigned int i = 0; i < 3; i++) {
+        add_attribute(location + i, 3, offset + i * 3 * sizeof(float));
+    }
+}
+
+void InstanceBuffer::update(const void* instances, size_t count) {
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    if (count > capacity) {
+        capacity = count;
+        glBufferData(GL_COPY_WRITE_BUFFER, capacity * stride, instances, GL_DYNAMIC_DRAW);
+    }
+    else {
+        glBufferData(GL_COPY_WRITE_BUFFER, capacity * stride, nullptr, GL_DYNAMIC_DRAW);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, 0, count * stride, instances);
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    instance_count = count;
+}
+
+void InstanceBuffer::bind_attributes() const {
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    for (const InstanceAttribute& attribute : attributes) {
+        glEnableVertexAttribArray(attribute.location);
+        glVertexAttribPointer(attribute.location, attribute.components, GL_FLOAT, GL_FALSE, (GLsizei)stride,
+            (void*)attribute.offset);
+        glVertexAttribDivisor(attribute.location, 1);
+    }
+}
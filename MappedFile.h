@@ -0,0 +1,121 @@
+#pragma once
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include <string>
+#include <cstddef>
+
+// Read-only view of a whole file. The mapping lives as long as the object.
+class MappedFile {
+public:
+    MappedFile(const std::string& path);
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool is_open() const { return opened; }
+    const char* data() const { return ptr; }
+    size_t size() const { return length; }
+    const char* begin() const { return ptr; }
+    const char* end() const { return ptr + length; }
+private:
+    const char* ptr = nullptr;
+    size_t length = 0;
+    bool opened = false;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = NULL;
+#else
+    int fd = -1;
+#endif
+};
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const std::string& path) {
+    file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        return;
+    }
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file, &file_size)) {
+        return;
+    }
+    length = (size_t)file_size.QuadPart;
+    opened = true;
+    // Zero sized files cannot be mapped, an empty view is still a valid file.
+    if (length == 0) {
+        return;
+    }
+    mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping == NULL) {
+        opened = false;
+        return;
+    }
+    ptr = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (ptr == nullptr) {
+        opened = false;
+    }
+}
+
+MappedFile::~MappedFile() {
+    if (ptr) {
+        UnmapViewOfFile(ptr);
+    }
+    if (mapping) {
+        CloseHandle(mapping);
+    }
+    if (file != INVALID_HANDLE_VALUE) {
+        CloseHandle(file);
+    }
+}
+
+#else
+
+MappedFile::MappedFile(const std::string& path) {
+    fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        return;
+    }
+    length = (size_t)st.st_size;
+    opened = true;
+    if (length == 0) {
+        return;
+    }
+    void* view = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (view == MAP_FAILED) {
+        opened = false;
+        return;
+    }
+    madvise(view, length, MADV_SEQUENTIAL);
+    ptr = (const char*)view;
+}
+
+MappedFile::~MappedFile() {
+    if (ptr) {
+        munmap((void*)ptr, length);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+#endif
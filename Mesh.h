@@ -7,10 +7,10 @@
 #include <glm/gtc/type_ptr.hpp>
 
 #include <Shader.h>
+#include <ObjLoader.h>
+#include <MeshCache.h>
 
 #include <vector>
-#include <fstream>
-#include <sstream>
 #include <iostream>
 
 enum TEXTURE {
@@ -38,21 +38,38 @@ public:
 private:
     unsigned int VBO, VAO, EBO;
     unsigned int textures[TEXTURE::TOTAL];
+    GLenum index_type = GL_UNSIGNED_INT;
+    unsigned int index_count = 0;
+    std::vector<unsigned short> short_indices;
 
     bool load_from_obj(const std::string& mesh_path);
-    bool setup();
+    bool load_from_cache(const std::string& mesh_path, uint64_t source_hash);
+    void write_cache(const std::string& mesh_path, uint64_t source_hash);
+    bool setup(const void* vertex_data, size_t vertex_count, const void* index_data, size_t index_count);
     void load_from_image(const std::string& texture_path);
 };
 
+// The OBJ path has no import options, bump MESH_CACHE_VERSION when the loader output changes.
+const uint32_t OBJ_IMPORT_FLAGS = 0;
+
 Mesh::Mesh(const std::string& mesh_path) {
+    uint64_t source_hash = 0;
+    bool hashed = hash_file(mesh_path, source_hash);
+    if (hashed && this->load_from_cache(mesh_path, source_hash)) {
+        return;
+    }
     if (!this->load_from_obj(mesh_path)) {
         std::cout << "ERROR::MESH::LOAD_FAILED" << std::endl;
         return;
     }
-    if (!this->setup()) {
+    const void* index_data = index_type == GL_UNSIGNED_SHORT ? (const void*)short_indices.data() : (const void*)indices.data();
+    if (!this->setup(vertices.data(), vertices.size(), index_data, indices.size())) {
         std::cout << "ERROR::MESH::SETUP_FAILED" << std::endl;
         return;
     }
+    if (hashed) {
+        this->write_cache(mesh_path, source_hash);
+    }
 }
 
 Mesh::~Mesh() {
@@ -62,72 +79,81 @@ Mesh::~Mesh() {
 }
 
 bool Mesh::load_from_obj(const std::string& mesh_path) {
-    std::ifstream mesh_file;
-    mesh_file.exceptions(std::ifstream::badbit);
-
-    try {
-        mesh_file.open(mesh_path);
-        std::vector<glm::vec3> pos, normal;
-        std::vector<glm::vec2> tex;
-        while (!mesh_file.eof()) {
-            char junk;
-            char line[128];
-            std::stringstream s;
-            mesh_file.getline(line, 128);
-            s << line;
-            float x, y, z;
-            if (line[0] == 'v') {
-                if (line[1] == 'n') {
-                    s >> junk >> junk >> x >> y >> z;
-                    normal.push_back(glm::vec3(x, y, z));
-                }
-                else if (line[1] == 't') {
-                    s >> junk >> junk >> x >> y;
-                    tex.push_back(glm::vec2(x, y));
-                }
-                else {
-                    s >> junk >> x >> y >> z;
-                    pos.push_back(glm::vec3(x, y, z));
-                }
-
-            }
-            if (line[0] == 'f') {
-                Vertex v;
-                s >> junk;
-                for (int i = 0; i < 3; i++) {
-                    s >> x >> junk >> y >> junk >> z; // Position / TexCoords / Normal
-                    v.Position = pos[x - 1];
-                    v.TexCoords = tex[y - 1];
-                    v.Normal = normal[z - 1];
-                    indices.push_back(indices.size());
-                    vertices.push_back(v);
-                }
-            }
-        }
-        pos.clear();
-        normal.clear();
-        tex.clear();
-        mesh_file.close();
-    }
-    catch (std::ifstream::failure& e) {
+    ObjData obj;
+    if (!load_obj(mesh_path, obj, 0)) {
         std::cout << "ERROR::MESH::FILE_NOT_READ_SUCCESSFULLY" << std::endl;
         return false;
     }
 
+    std::vector<ObjIndex> unique;
+    weld_obj(obj, unique, indices);
+
+    vertices.reserve(unique.size());
+    for (const ObjIndex& corner : unique) {
+        if (corner.position < 0 || corner.position >= (int)obj.positions.size() ||
+            corner.texcoord >= (int)obj.texcoords.size() || corner.normal >= (int)obj.normals.size()) {
+            std::cout << "ERROR::MESH::INVALID_FACE_INDEX" << std::endl;
+            return false;
+        }
+        Vertex v;
+        v.Position = obj.positions[corner.position];
+        v.TexCoords = corner.texcoord >= 0 ? obj.texcoords[corner.texcoord] : glm::vec2(0.0f);
+        v.Normal = corner.normal >= 0 ? obj.normals[corner.normal] : glm::vec3(0.0f);
+        vertices.push_back(v);
+    }
+
+    index_type = vertices.size() <= 0x10000 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+    if (index_type == GL_UNSIGNED_SHORT) {
+        short_indices.assign(indices.begin(), indices.end());
+    }
+    size_t index_size = index_type == GL_UNSIGNED_SHORT ? sizeof(unsigned short) : sizeof(unsigned int);
+    size_t before = obj.corners.size() * (sizeof(Vertex) + sizeof(unsigned int));
+    size_t after = vertices.size() * sizeof(Vertex) + indices.size() * index_size;
+    std::cout << "MESH::WELD " << mesh_path << ": " << obj.corners.size() << " -> " << vertices.size()
+        << " vertices, " << before / 1024 << " KB -> " << after / 1024 << " KB" << std::endl;
+
     return true;
 }
 
-bool Mesh::setup() {
+bool Mesh::load_from_cache(const std::string& mesh_path, uint64_t source_hash) {
+    MeshCache cache(mesh_cache_path(mesh_path), source_hash, OBJ_IMPORT_FLAGS, sizeof(Vertex));
+    if (!cache.is_valid() || cache.header().submesh_count != 1) {
+        return false;
+    }
+    index_type = cache.header().index_size == sizeof(unsigned short) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+    return setup(cache.vertices(), cache.header().vertex_count, cache.indices(), cache.header().index_count);
+}
+
+void Mesh::write_cache(const std::string& mesh_path, uint64_t source_hash) {
+    bool short_index = index_type == GL_UNSIGNED_SHORT;
+    MeshCacheWriter writer(sizeof(Vertex), short_index ? sizeof(unsigned short) : sizeof(unsigned int));
+    AABB bounds;
+    for (const Vertex& v : vertices) {
+        bounds.expand(v.Position);
+    }
+    writer.add_submesh(vertices.data(), vertices.size(),
+        short_index ? (const void*)short_indices.data() : (const void*)indices.data(), indices.size(),
+        &bounds.min.x, &bounds.max.x);
+    if (!writer.write(mesh_cache_path(mesh_path), source_hash, OBJ_IMPORT_FLAGS)) {
+        std::cout << "ERROR::MESH::CACHE_WRITE_FAILED " << mesh_cache_path(mesh_path) << std::endl;
+    }
+}
+
+// Vertex and index data may point into a mapped cache file, they are only read here.
+bool Mesh::setup(const void* vertex_data, size_t vertex_count, const void* index_data, size_t index_count) {
+    this->index_count = (unsigned int)index_count;
+    size_t index_size = index_type == GL_UNSIGNED_SHORT ? sizeof(unsigned short) : sizeof(unsigned int);
+
     glGenVertexArrays(1, &VAO);
     glBindVertexArray(VAO);
 
     glGenBuffers(1, &EBO);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, index_count * index_size, index_data, GL_STATIC_DRAW);
 
     glGenBuffers(1, &VBO);
     glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, vertex_count * sizeof(Vertex), vertex_data, GL_STATIC_DRAW);
 
     glEnableVertexAttribArray(0);
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0); // Position
@@ -150,7 +176,7 @@ bool Mesh::draw(Shader& shader) {
         glBindTexture(GL_TEXTURE_2D, textures[i]);
     }
     glBindVertexArray(VAO);
-    glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
+    glDrawElements(GL_TRIANGLES, index_count, index_type, 0);
     glBindVertexArray(0);
 
     return true;
@@ -0,0 +1,254 @@
+#pragma once
+
+#include <MappedFile.h>
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <thread>
+#include <functional>
+#include <filesystem>
+
+// Binary cache of imported geometry, stored next to the source as <source>.meshcache.
+// Layout: header, submesh table, texture table, string pool, vertex data, index data.
+// Vertex and index data are 16 byte aligned so they can be handed to glBufferData straight from the mapping.
+
+const uint32_t MESH_CACHE_VERSION = 2;
+
+struct MeshCacheHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t source_hash;
+    uint32_t import_flags;
+    uint32_t vertex_stride;
+    uint32_t index_size;
+    uint32_t submesh_count;
+    uint32_t texture_count;
+    uint32_t string_size;
+    uint64_t vertex_count;
+    uint64_t index_count;
+    uint64_t vertex_offset;
+    uint64_t index_offset;
+};
+
+struct MeshCacheSubmesh {
+    uint32_t first_vertex;
+    uint32_t vertex_count;
+    uint32_t first_index;
+    uint32_t index_count;
+    uint32_t first_texture;
+    uint32_t texture_count;
+    // Bounding box of the submesh's vertices, computed at import.
+    float bounds_min[3];
+    float bounds_max[3];
+};
+
+struct MeshCacheTexture {
+    uint32_t type;
+    uint32_t path_offset;
+    uint32_t path_length;
+    uint32_t reserved;
+};
+
+std::string mesh_cache_path(const std::string& source_path);
+uint64_t hash_bytes(const char* data, size_t size, uint64_t seed = 0);
+bool hash_file(const std::string& path, uint64_t& hash);
+
+class MeshCacheWriter {
+public:
+    MeshCacheWriter(uint32_t vertex_stride, uint32_t index_size);
+
+    // bounds_min and bounds_max are three floats each.
+    void add_submesh(const void* vertices, size_t vertex_count, const void* indices, size_t index_count,
+        const float* bounds_min, const float* bounds_max);
+    // The texture belongs to the submesh added last.
+    void add_texture(uint32_t type, const std::string& path);
+    bool write(const std::string& cache_path, uint64_t source_hash, uint32_t import_flags);
+private:
+    uint32_t vertex_stride, index_size;
+    std::vector<char> vertices, indices;
+    std::vector<MeshCacheSubmesh> submeshes;
+    std::vector<MeshCacheTexture> textures;
+    std::string strings;
+};
+
+class MeshCache {
+public:
+    // Maps the cache and checks it against the source hash and import flags.
+    MeshCache(const std::string& cache_path, uint64_t source_hash, uint32_t import_flags,
+        uint32_t vertex_stride);
+
+    bool is_valid() const { return valid; }
+    const MeshCacheHeader& header() const { return *(const MeshCacheHeader*)file.data(); }
+    const MeshCacheSubmesh* submeshes() const { return (const MeshCacheSubmesh*)(file.data() + sizeof(MeshCacheHeader)); }
+    const MeshCacheTexture* textures() const { return (const MeshCacheTexture*)(submeshes() + header().submesh_count); }
+    std::string texture_path(const MeshCacheTexture& texture) const;
+    const char* vertices() const { return file.data() + header().vertex_offset; }
+    const char* indices() const { return file.data() + header().index_offset; }
+private:
+    MappedFile file;
+    bool valid = false;
+
+    const char* strings() const { return (const char*)(textures() + header().texture_count); }
+};
+
+namespace mesh_cache {
+    const char MAGIC[4] = { 'M', 'S', 'H', 'C' };
+
+    size_t align16(size_t offset) {
+        return (offset + 15) & ~(size_t)15;
+    }
+}
+
+std::string mesh_cache_path(const std::string& source_path) {
+    return source_path + ".meshcache";
+}
+
+uint64_t hash_bytes(const char* data, size_t size, uint64_t seed) {
+    uint64_t h = seed ^ (size * 0x9E3779B97F4A7C15ull);
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        std::memcpy(&word, data + i, 8);
+        h ^= word * 0xFF51AFD7ED558CCDull;
+        h = ((h << 31) | (h >> 33)) * 0xC4CEB9FE1A85EC53ull;
+    }
+    for (; i < size; i++) {
+        h ^= (unsigned char)data[i];
+        h *= 0x100000001B3ull;
+    }
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDull;
+    h ^= h >> 33;
+    return h;
+}
+
+bool hash_file(const std::string& path, uint64_t& hash) {
+    MappedFile file(path);
+    if (!file.is_open()) {
+        return false;
+    }
+    hash = hash_bytes(file.data(), file.size());
+    return true;
+}
+
+MeshCacheWriter::MeshCacheWriter(uint32_t vertex_stride, uint32_t index_size) {
+    this->vertex_stride = vertex_stride;
+    this->index_size = index_size;
+}
+
+void MeshCacheWriter::add_submesh(const void* vertices, size_t vertex_count,
+    const void* indices, size_t index_count, const float* bounds_min, const float* bounds_max) {
+    MeshCacheSubmesh submesh;
+    submesh.first_vertex = (uint32_t)(this->vertices.size() / vertex_stride);
+    submesh.vertex_count = (uint32_t)vertex_count;
+    submesh.first_index = (uint32_t)(this->indices.size() / index_size);
+    submesh.index_count = (uint32_t)index_count;
+    submesh.first_texture = (uint32_t)textures.size();
+    submesh.texture_count = 0;
+    std::memcpy(submesh.bounds_min, bounds_min, sizeof(submesh.bounds_min));
+    std::memcpy(submesh.bounds_max, bounds_max, sizeof(submesh.bounds_max));
+    submeshes.push_back(submesh);
+
+    this->vertices.insert(this->vertices.end(), (const char*)vertices,
+        (const char*)vertices + vertex_count * vertex_stride);
+    this->indices.insert(this->indices.end(), (const char*)indices,
+        (const char*)indices + index_count * index_size);
+}
+
+void MeshCacheWriter::add_texture(uint32_t type, const std::string& path) {
+    MeshCacheTexture texture;
+    texture.type = type;
+    texture.path_offset = (uint32_t)strings.size();
+    texture.path_length = (uint32_t)path.size();
+    texture.reserved = 0;
+    textures.push_back(texture);
+    strings += path;
+    submeshes.back().texture_count++;
+}
+
+bool MeshCacheWriter::write(const std::string& cache_path, uint64_t source_hash, uint32_t import_flags) {
+    MeshCacheHeader header;
+    std::memcpy(header.magic, mesh_cache::MAGIC, 4);
+    header.version = MESH_CACHE_VERSION;
+    header.source_hash = source_hash;
+    header.import_flags = import_flags;
+    header.vertex_stride = vertex_stride;
+    header.index_size = index_size;
+    header.submesh_count = (uint32_t)submeshes.size();
+    header.texture_count = (uint32_t)textures.size();
+    header.string_size = (uint32_t)strings.size();
+    header.vertex_count = vertices.size() / vertex_stride;
+    header.index_count = indices.size() / index_size;
+
+    size_t tables = sizeof(MeshCacheHeader) + submeshes.size() * sizeof(MeshCacheSubmesh) +
+        textures.size() * sizeof(MeshCacheTexture) + strings.size();
+    header.vertex_offset = mesh_cache::align16(tables);
+    header.index_offset = mesh_cache::align16(header.vertex_offset + vertices.size());
+
+    // Written under a per-thread name and renamed, concurrent imports of one source never see a torn file.
+    std::string temp_path = cache_path + "." + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+    std::ofstream out(temp_path, std::ofstream::binary | std::ofstream::trunc);
+    if (!out) {
+        return false;
+    }
+    const char padding[16] = {};
+    out.write((const char*)&header, sizeof(header));
+    out.write((const char*)submeshes.data(), submeshes.size() * sizeof(MeshCacheSubmesh));
+    out.write((const char*)textures.data(), textures.size() * sizeof(MeshCacheTexture));
+    out.write(strings.data(), strings.size());
+    out.write(padding, header.vertex_offset - tables);
+    out.write(vertices.data(), vertices.size());
+    out.write(padding, header.index_offset - (header.vertex_offset + vertices.size()));
+    out.write(indices.data(), indices.size());
+    out.close();
+    std::error_code error;
+    if (out) {
+        std::filesystem::rename(temp_path, cache_path, error);
+    }
+    if (!out || error) {
+        std::remove(temp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+MeshCache::MeshCache(const std::string& cache_path, uint64_t source_hash, uint32_t import_flags,
+    uint32_t vertex_stride) : file(cache_path) {
+    if (!file.is_open() || file.size() < sizeof(MeshCacheHeader)) {
+        return;
+    }
+    const MeshCacheHeader& h = header();
+    if (std::memcmp(h.magic, mesh_cache::MAGIC, 4) != 0 || h.version != MESH_CACHE_VERSION ||
+        h.source_hash != source_hash || h.import_flags != import_flags || h.vertex_stride != vertex_stride ||
+        (h.index_size != 2 && h.index_size != 4)) {
+        return;
+    }
+    uint64_t tables = sizeof(MeshCacheHeader) + (uint64_t)h.submesh_count * sizeof(MeshCacheSubmesh) +
+        (uint64_t)h.texture_count * sizeof(MeshCacheTexture) + h.string_size;
+    if (h.vertex_offset < tables || h.index_offset < h.vertex_offset + h.vertex_count * h.vertex_stride ||
+        h.index_offset + h.index_count * h.index_size > file.size()) {
+        return;
+    }
+    for (uint32_t i = 0; i < h.submesh_count; i++) {
+        const MeshCacheSubmesh& s = submeshes()[i];
+        if ((uint64_t)s.first_vertex + s.vertex_count > h.vertex_count ||
+            (uint64_t)s.first_index + s.index_count > h.index_count ||
+            (uint64_t)s.first_texture + s.texture_count > h.texture_count) {
+            return;
+        }
+    }
+    for (uint32_t i = 0; i < h.texture_count; i++) {
+        if ((uint64_t)textures()[i].path_offset + textures()[i].path_length > h.string_size) {
+            return;
+        }
+    }
+    valid = true;
+}
+
+std::string MeshCache::texture_path(const MeshCacheTexture& texture) const {
+    return std::string(strings() + texture.path_offset, texture.path_length);
+}
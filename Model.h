@@ -7,75 +7,795 @@
 #include <glm/gtc/type_ptr.hpp>
 
 #include <Header.h>
+#include <MeshCache.h>
+#include <ObjLoader.h>
+#include <ThreadPool.h>
+#include <UploadThread.h>
+#include <GpuProfiler.h>
+#include <Trace.h>
+#include <Frustum.h>
+#include <OcclusionBuffer.h>
 
 #include <vector>
 #include <string>
+#include <memory>
+#include <future>
 #include <iostream>
 
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 
-void load_texture(const std::string& texture_path, unsigned int* id);
-void load_from_image(const std::string& texture_path);
+const unsigned int MODEL_IMPORT_FLAGS = aiProcess_Triangulate | aiProcess_FlipUVs;
+// Recorded in caches written by the built-in OBJ path instead of the Assimp flags, so neither path
+// reads the other's cache. Bump MESH_CACHE_VERSION when that path's output changes.
+const unsigned int MODEL_OBJ_IMPORT_FLAGS = 1u << 31;
 
+struct TextureRef {
+	TextureType type;
+	std::string path;
+};
+
+// CPU side of one submesh, built without touching GL.
+struct MeshData {
+	std::vector<Vertex> vertices;
+	std::vector<unsigned int> indices;
+	std::vector<TextureRef> textures;
+	AABB bounds;
+};
+
+// Result of the CPU half of an import: either a mapped mesh cache or the converted meshes.
+struct ModelData {
+	std::string path;
+	std::vector<MeshData> meshes;
+	std::unique_ptr<MeshCache> cache;
+};
 
 class Model {
 public:
-	Model(const std::string path);
-
+	// merged packs every submesh into one vertex buffer, one index buffer and one VAO; submeshes are
+	// then drawn with base vertex draws, consecutive ones sharing textures in one multi-draw.
+	Model(const std::string path, bool merged = false);
+	// Creates the GL objects for data imported on another thread, call on the GL thread.
+	Model(ModelData& data, bool merged = false);
+
+	// Cache lookup, then for .obj files the built-in parser with welded vertices, one submesh per
+	// material, and for anything else an Assimp import plus aiMesh conversion. No GL calls so it can run
+	// on any thread. With a pool the meshes are converted in parallel.
+	static ModelData import(const std::string& path, ThreadPool* pool = nullptr, bool use_cache = true);
+	// Imports all paths concurrently on the pool, uploads on the calling thread in order.
+	static std::vector<Model> load_models(const std::vector<std::string>& paths, ThreadPool& pool,
+		bool merged = false);
+	// Imports on the pool and creates the buffers on the upload thread without blocking the caller.
+	// The model is finished on the render thread by UploadThread::poll and draws nothing until then.
+	static std::shared_ptr<Model> load_async(const std::string& path, ThreadPool& pool, UploadThread& uploader,
+		bool merged = false);
+
+	bool is_ready() const { return ready; }
+	// File name of the model, labels its GPU profiler scopes.
+	const std::string& get_name() const { return name; }
 	void draw(Shader& shader);	
+	// Draws each submesh with the variant matching its textures, scene_features adds the light count.
+	// Submeshes whose variant is still compiling are skipped (and counted) rather than waited for.
+	void draw(ShaderVariants& variants, uint32_t scene_features);
+	// Draws instances.count() copies with one instanced draw per submesh. The shader must be an
+	// instanced variant that takes the model matrix from the instance attributes.
+	void draw_instanced(Shader& shader, InstanceBuffer& instances);
+	// Same with the INSTANCED lit variant of each submesh, instances holding LitInstance structs. Skips
+	// submeshes whose variant is still compiling like draw(variants, scene_features).
+	void draw_instanced(ShaderVariants& variants, uint32_t scene_features, InstanceBuffer& instances);
+	// Draws submesh i alone, whether or not it passed the last cull. For callers that decide visibility
+	// per submesh themselves, such as OcclusionQueries.
+	void draw_mesh(size_t i, ShaderVariants& variants, uint32_t scene_features);
+	size_t mesh_count() const { return meshes.size(); }
+	bool is_mesh_visible(size_t i) const { return visible[i] != 0; }
+	size_t mesh_triangles(size_t i) const { return meshes[i].range().index_count / 3; }
+
+	// Bounds in model space, of the whole model and of each submesh.
+	const AABB& get_bounds() const { return bounds; }
+	const AABBList& get_mesh_bounds() const { return mesh_bounds; }
+	// Marks the submeshes outside frustum, which the draws then skip until the next cull. The frustum
+	// must be in model space, built from projection * view * model. Returns the visible count.
+	size_t cull(const Frustum& frustum);
+	// Also marks the submeshes that passed cull() but are hidden in buffer, which must be rendered for
+	// this frame. Returns how many of them were hidden.
+	size_t cull_occluded(const OcclusionBuffer& buffer, const glm::mat4& model_view_projection);
 private:
+	struct MeshBuffers {
+		unsigned int VBO;
+		unsigned int EBO;
+		size_t index_count;
+		std::vector<TextureRef> textures;
+		size_t first_index = 0;
+		int base_vertex = 0;
+		AABB bounds;
+	};
+
+	// Consecutive submeshes of a merged model with the same textures.
+	struct DrawGroup {
+		size_t first_mesh;
+		std::vector<GLsizei> counts;
+		std::vector<const void*> offsets;
+		std::vector<GLint> base_vertices;
+		size_t triangles = 0;
+	};
+
 	std::vector<Mesh> meshes;
 	std::string directory_path;
-	std::vector<Texture> textures_loaded;
-
-	void load_model(std::string path);
-	void process_node(aiNode *node, const aiScene *scene);
-	Mesh process_mesh(aiMesh *mesh, const aiScene *scene);
-	std::vector<Texture> load_material_texture(aiMaterial *mat, 
-					aiTextureType type, TextureType type_name);
+	std::string name;
+	bool ready = false;
+	bool merged = false;
+	unsigned int VAO = 0;
+	unsigned int attached_instances = 0;
+	std::vector<DrawGroup> groups;
+	// Submeshes of a partly visible group, rebuilt per draw.
+	DrawGroup visible_group;
+	AABB bounds;
+	AABBList mesh_bounds;
+	// 1 for submeshes that passed the last cull, all 1 until the first.
+	std::vector<uint8_t> visible;
+
+	Model() = default;
+	void add_bounds(const AABB& mesh);
+	static AABB cache_bounds(const MeshCacheSubmesh& submesh);
+	void upload(ModelData& data);
+	static std::vector<MeshBuffers> stream_buffers(const ModelData& data, bool merged);
+	void build_draw_groups();
+	template<typename PickShader>
+	void draw_groups(PickShader pick_shader);
+	template<typename PickShader>
+	void draw_instanced_groups(PickShader pick_shader, InstanceBuffer& instances);
+	const DrawGroup& visible_subset(const DrawGroup& group);
+	void adopt_buffers(const std::string& path, const std::vector<MeshBuffers>& buffers);
+	static bool hash_sources(const std::string& path, bool obj_file, uint64_t& hash);
+	static bool import_obj(const std::string& path, ModelData& data, ThreadPool* pool);
+	static bool convert_obj(const ObjData& obj, size_t first, size_t count, const ObjMaterial* material,
+		MeshData& out);
+	static bool import_assimp(const std::string& path, ModelData& data, ThreadPool* pool);
+	static void write_cache(const ModelData& data, uint64_t source_hash, uint32_t import_flags);
+	static void process_node(aiNode *node, const aiScene *scene, std::vector<aiMesh*>& out);
+	static MeshData process_mesh(aiMesh *mesh, const aiScene *scene);
+	static void load_material_texture(aiMaterial *mat, aiTextureType type,
+					TextureType type_name, std::vector<TextureRef>& textures);
+	Texture get_texture(const std::string& path, TextureType type_name);
 };
 
-Model::Model(const std::string path) {
-	load_model(path);
+Model::Model(const std::string path, bool merged) {
+	this->merged = merged;
+	ModelData data = import(path);
+	upload(data);
+}
+
+Model::Model(ModelData& data, bool merged) {
+	this->merged = merged;
+	upload(data);
 }
 
 void Model::draw(Shader& shader) {
-	for (unsigned int i = 0; i < meshes.size(); i++) {
-		meshes[i].draw(shader);
+	TRACE_SCOPE("Model::draw");
+	bool per_draw = GpuProfiler::instance().is_per_draw();
+	GpuScope scope(name.c_str(), per_draw);
+	if (!merged) {
+		for (unsigned int i = 0; i < meshes.size(); i++) {
+			if (!visible[i]) {
+				continue;
+			}
+			GpuScope mesh_scope("mesh", per_draw, (int)i);
+			meshes[i].draw(shader);
+		}
+		return;
+	}
+	draw_groups([&shader](const Mesh&) { return &shader; });
+}
+
+void Model::draw(ShaderVariants& variants, uint32_t scene_features) {
+	TRACE_SCOPE("Model::draw");
+	bool per_draw = GpuProfiler::instance().is_per_draw();
+	GpuScope scope(name.c_str(), per_draw);
+	if (!merged) {
+		for (unsigned int i = 0; i < meshes.size(); i++) {
+			if (!visible[i]) {
+				continue;
+			}
+			Shader* shader = variants.try_get(meshes[i].features() | scene_features);
+			if (shader == nullptr) {
+				draw_stats.skipped_draws++;
+				continue;
+			}
+			GpuScope mesh_scope("mesh", per_draw, (int)i);
+			meshes[i].draw(*shader);
+		}
+		return;
+	}
+	// A group shares its textures, so it shares its variant too.
+	draw_groups([&variants, scene_features](const Mesh& mesh) {
+		return variants.try_get(mesh.features() | scene_features);
+	});
+}
+
+void Model::draw_mesh(size_t i, ShaderVariants& variants, uint32_t scene_features) {
+	Shader* shader = variants.try_get(meshes[i].features() | scene_features);
+	if (shader == nullptr) {
+		draw_stats.skipped_draws++;
+		return;
+	}
+	GpuScope mesh_scope("mesh", GpuProfiler::instance().is_per_draw(), (int)i);
+	meshes[i].draw(*shader);
+}
+
+template<typename PickShader>
+void Model::draw_groups(PickShader pick_shader) {
+	if (groups.empty()) {
+		return;
+	}
+
+	GLState::instance().bind_vertex_array(VAO);
+	draw_stats.vao_binds++;
+	bool per_draw = GpuProfiler::instance().is_per_draw();
+	for (const DrawGroup& all : groups) {
+		// Culled submeshes are dropped from the group's arrays, a fully culled group is skipped.
+		size_t visible_count = 0, last_visible = all.first_mesh;
+		for (size_t i = 0; i < all.counts.size(); i++) {
+			if (visible[all.first_mesh + i]) {
+				visible_count++;
+				last_visible = all.first_mesh + i;
+			}
+		}
+		if (visible_count == 0) {
+			continue;
+		}
+		const DrawGroup& group = visible_count == all.counts.size() ? all : visible_subset(all);
+		Shader* shader = pick_shader(meshes[all.first_mesh]);
+		if (shader == nullptr) {
+			draw_stats.skipped_draws++;
+			continue;
+		}
+		// Indexed by the group's first submesh.
+		GpuScope group_scope("group", per_draw, (int)all.first_mesh);
+		if (!meshes[all.first_mesh].bind_textures(*shader)) {
+			continue;
+		}
+		if (group.counts.size() == 1) {
+			meshes[last_visible].draw_elements();
+			continue;
+		}
+		glMultiDrawElementsBaseVertex(GL_TRIANGLES, group.counts.data(), GL_UNSIGNED_INT, group.offsets.data(),
+			(GLsizei)group.counts.size(), group.base_vertices.data());
+		draw_stats.draw_calls++;
+		draw_stats.triangles += group.triangles;
+	}
+}
+
+void Model::draw_instanced(Shader& shader, InstanceBuffer& instances) {
+	draw_instanced_groups([&shader](const Mesh&) { return &shader; }, instances);
+}
+
+void Model::draw_instanced(ShaderVariants& variants, uint32_t scene_features, InstanceBuffer& instances) {
+	uint32_t features = scene_features | shader_features::INSTANCED;
+	draw_instanced_groups([&variants, features](const Mesh& mesh) {
+		return variants.try_get(mesh.features() | features);
+	}, instances);
+}
+
+template<typename PickShader>
+void Model::draw_instanced_groups(PickShader pick_shader, InstanceBuffer& instances) {
+	TRACE_SCOPE("Model::draw_instanced");
+	bool per_draw = GpuProfiler::instance().is_per_draw();
+	GpuScope scope(name.c_str(), per_draw);
+	if (!merged) {
+		for (unsigned int i = 0; i < meshes.size(); i++) {
+			if (!visible[i]) {
+				continue;
+			}
+			Shader* shader = pick_shader(meshes[i]);
+			if (shader == nullptr) {
+				draw_stats.skipped_draws++;
+				continue;
+			}
+			GpuScope mesh_scope("mesh", per_draw, (int)i);
+			meshes[i].draw_instanced(*shader, instances);
+		}
+		return;
+	}
+	if (groups.empty() || instances.count() == 0) {
+		return;
+	}
+
+	GLState::instance().bind_vertex_array(VAO);
+	draw_stats.vao_binds++;
+	if (attached_instances != instances.id()) {
+		instances.bind_attributes();
+		attached_instances = instances.id();
+	}
+	// GL 4.0 has no instanced multi-draw short of indirect draws, so one draw per submesh.
+	for (const DrawGroup& group : groups) {
+		Shader* shader = pick_shader(meshes[group.first_mesh]);
+		if (shader == nullptr) {
+			draw_stats.skipped_draws++;
+			continue;
+		}
+		if (!meshes[group.first_mesh].bind_textures(*shader)) {
+			continue;
+		}
+		GpuScope group_scope("group", per_draw, (int)group.first_mesh);
+		for (size_t i = 0; i < group.counts.size(); i++) {
+			if (visible[group.first_mesh + i]) {
+				meshes[group.first_mesh + i].draw_elements_instanced(instances.count());
+			}
+		}
+	}
+}
+
+const Model::DrawGroup& Model::visible_subset(const DrawGroup& group) {
+	visible_group.first_mesh = group.first_mesh;
+	visible_group.counts.clear();
+	visible_group.offsets.clear();
+	visible_group.base_vertices.clear();
+	visible_group.triangles = 0;
+	for (size_t i = 0; i < group.counts.size(); i++) {
+		if (visible[group.first_mesh + i]) {
+			visible_group.counts.push_back(group.counts[i]);
+			visible_group.offsets.push_back(group.offsets[i]);
+			visible_group.base_vertices.push_back(group.base_vertices[i]);
+			visible_group.triangles += group.counts[i] / 3;
+		}
+	}
+	return visible_group;
+}
+
+size_t Model::cull(const Frustum& frustum) {
+	TRACE_SCOPE("Model::cull");
+	size_t count = frustum::cull(frustum, mesh_bounds, visible.data());
+	draw_stats.visible_meshes += (unsigned int)count;
+	draw_stats.culled_meshes += (unsigned int)(mesh_bounds.size() - count);
+	return count;
+}
+
+size_t Model::cull_occluded(const OcclusionBuffer& buffer, const glm::mat4& model_view_projection) {
+	TRACE_SCOPE("Model::cull_occluded");
+	size_t occluded = 0;
+	for (size_t i = 0; i < visible.size(); i++) {
+		if (visible[i] && !buffer.is_visible(mesh_bounds.get(i), model_view_projection)) {
+			visible[i] = 0;
+			occluded++;
+		}
+	}
+	draw_stats.occluded_meshes += (unsigned int)occluded;
+	return occluded;
+}
+
+void Model::add_bounds(const AABB& mesh) {
+	bounds.expand(mesh);
+	mesh_bounds.push_back(mesh);
+	visible.push_back(1);
+}
+
+AABB Model::cache_bounds(const MeshCacheSubmesh& submesh) {
+	AABB box;
+	box.min = glm::vec3(submesh.bounds_min[0], submesh.bounds_min[1], submesh.bounds_min[2]);
+	box.max = glm::vec3(submesh.bounds_max[0], submesh.bounds_max[1], submesh.bounds_max[2]);
+	return box;
+}
+
+void Model::build_draw_groups() {
+	groups.clear();
+	for (size_t i = 0; i < meshes.size(); i++) {
+		if (groups.empty() || !meshes[i].same_textures(meshes[groups.back().first_mesh])) {
+			DrawGroup group;
+			group.first_mesh = i;
+			groups.push_back(group);
+		}
+		MeshRange range = meshes[i].range();
+		groups.back().counts.push_back((GLsizei)range.index_count);
+		groups.back().offsets.push_back((const void*)(range.first_index * sizeof(unsigned int)));
+		groups.back().base_vertices.push_back(range.base_vertex);
+		groups.back().triangles += range.index_count / 3;
 	}
 }
 
-void Model::load_model(std::string path) {
+ModelData Model::import(const std::string& path, ThreadPool* pool, bool use_cache) {
+	TRACE_SCOPE("Model::import");
+	ModelData data;
+	data.path = path;
+
+	size_t extension = path.find_last_of('.');
+	bool obj_file = extension != std::string::npos && path.compare(extension, std::string::npos, ".obj") == 0;
+	uint32_t import_flags = obj_file ? MODEL_OBJ_IMPORT_FLAGS : MODEL_IMPORT_FLAGS;
+
+	uint64_t source_hash = 0;
+	bool hashed = use_cache && hash_sources(path, obj_file, source_hash);
+	if (hashed) {
+		std::unique_ptr<MeshCache> cache = std::make_unique<MeshCache>(mesh_cache_path(path), source_hash,
+			import_flags, (uint32_t)sizeof(Vertex));
+		if (cache->is_valid() && cache->header().index_size == sizeof(unsigned int)) {
+			data.cache = std::move(cache);
+			return data;
+		}
+	}
+
+	bool imported = obj_file ? import_obj(path, data, pool) : import_assimp(path, data, pool);
+	if (imported && hashed) {
+		write_cache(data, source_hash, import_flags);
+	}
+	return data;
+}
+
+// Cache key over everything the import reads. For OBJ files that is the file itself, the MTL files it
+// names and, by path and modification time, the textures those name: editing the MTL or replacing a
+// texture gives a new key. Other formats are hashed alone.
+bool Model::hash_sources(const std::string& path, bool obj_file, uint64_t& hash) {
+	MappedFile file(path);
+	if (!file.is_open()) {
+		return false;
+	}
+	hash = hash_bytes(file.data(), file.size());
+	if (!obj_file) {
+		return true;
+	}
+	std::string directory = path.substr(0, path.find_last_of("/\\") + 1);
+	for (const std::string& library : find_material_libraries(file.begin(), file.end())) {
+		// A missing MTL still changes the key by its name, and again once it appears.
+		hash = hash_bytes(library.data(), library.size(), hash);
+		MappedFile mtl(directory + library);
+		if (!mtl.is_open()) {
+			continue;
+		}
+		hash = hash_bytes(mtl.data(), mtl.size(), hash);
+		std::vector<ObjMaterial> materials;
+		parse_mtl(mtl.begin(), mtl.end(), materials);
+		for (const ObjMaterial& material : materials) {
+			for (const std::string* map : { &material.diffuse_map, &material.specular_map, &material.emission_map }) {
+				if (map->empty()) {
+					continue;
+				}
+				std::string texture = directory + *map;
+				hash = hash_bytes(texture.data(), texture.size(), hash);
+				std::error_code error;
+				int64_t modified = (int64_t)std::filesystem::last_write_time(texture, error).time_since_epoch().count();
+				if (!error) {
+					hash = hash_bytes((const char*)&modified, sizeof(modified), hash);
+				}
+			}
+		}
+	}
+	return true;
+}
+
+bool Model::import_obj(const std::string& path, ModelData& data, ThreadPool* pool) {
+	TRACE_SCOPE("Model::import_obj");
+	ObjData obj;
+	if (!load_obj(path, obj, pool ? pool->size() : 1)) {
+		std::cout << "ERROR::MODEL::OBJ_NOT_READ " << path << std::endl;
+		return false;
+	}
+	std::string directory = path.substr(0, path.find_last_of("/\\") + 1);
+	std::vector<ObjMaterial> materials;
+	for (const std::string& library : obj.material_libraries) {
+		if (!load_mtl(directory + library, materials)) {
+			std::cout << "ERROR::MODEL::MTL_NOT_READ " << directory + library << std::endl;
+		}
+	}
+
+	// One submesh per material range, faces before the first usemtl get one without textures.
+	std::vector<ObjMaterialRange> ranges;
+	if (obj.materials.empty() || obj.materials[0].first_corner > 0) {
+		ranges.push_back({ std::string(), 0 });
+	}
+	ranges.insert(ranges.end(), obj.materials.begin(), obj.materials.end());
+	std::vector<MeshData> meshes(ranges.size());
+	std::vector<uint8_t> converted(ranges.size());
+	auto convert = [&](size_t i) {
+		size_t first = ranges[i].first_corner;
+		size_t last = i + 1 < ranges.size() ? ranges[i + 1].first_corner : obj.corners.size();
+		const ObjMaterial* material = nullptr;
+		for (const ObjMaterial& candidate : materials) {
+			if (candidate.name == ranges[i].material) {
+				material = &candidate;
+			}
+		}
+		converted[i] = convert_obj(obj, first, last - first, material, meshes[i]) ? 1 : 0;
+	};
+	if (pool) {
+		pool->parallel_for(ranges.size(), convert);
+	}
+	else {
+		for (size_t i = 0; i < ranges.size(); i++) {
+			convert(i);
+		}
+	}
+
+	size_t vertex_count = 0;
+	for (size_t i = 0; i < meshes.size(); i++) {
+		if (!converted[i]) {
+			std::cout << "ERROR::MODEL::INVALID_FACE_INDEX " << path << std::endl;
+			return false;
+		}
+		if (!meshes[i].indices.empty()) {
+			vertex_count += meshes[i].vertices.size();
+			data.meshes.push_back(std::move(meshes[i]));
+		}
+	}
+	std::cout << "MODEL::WELD " << path << ": " << obj.corners.size() << " -> " << vertex_count << " vertices in "
+		<< data.meshes.size() << " submeshes" << std::endl;
+	return true;
+}
+
+bool Model::convert_obj(const ObjData& obj, size_t first, size_t count, const ObjMaterial* material,
+	MeshData& out) {
+	std::vector<ObjIndex> unique;
+	weld_obj(obj, first, count, unique, out.indices);
+	out.vertices.reserve(unique.size());
+	for (const ObjIndex& corner : unique) {
+		if (corner.position < 0 || corner.position >= (int)obj.positions.size() ||
+			corner.texcoord >= (int)obj.texcoords.size() || corner.normal >= (int)obj.normals.size()) {
+			return false;
+		}
+		Vertex vertex;
+		vertex.Position = obj.positions[corner.position];
+		vertex.Normal = corner.normal >= 0 ? obj.normals[corner.normal] : glm::vec3(0.0f);
+		// Flipped like aiProcess_FlipUVs does on the Assimp path.
+		vertex.TexCoords = corner.texcoord >= 0 ?
+			glm::vec2(obj.texcoords[corner.texcoord].x, 1.0f - obj.texcoords[corner.texcoord].y) : glm::vec2(0.0f);
+		out.bounds.expand(vertex.Position);
+		out.vertices.push_back(vertex);
+	}
+
+	if (material) {
+		if (!material->diffuse_map.empty()) {
+			out.textures.push_back({ TextureType::DIFFUSE, material->diffuse_map });
+		}
+		if (!material->specular_map.empty()) {
+			out.textures.push_back({ TextureType::SPECULAR, material->specular_map });
+		}
+		if (!material->emission_map.empty()) {
+			out.textures.push_back({ TextureType::EMISSION, material->emission_map });
+		}
+	}
+	return true;
+}
+
+bool Model::import_assimp(const std::string& path, ModelData& data, ThreadPool* pool) {
+	TRACE_SCOPE("Model::import_assimp");
 	Assimp::Importer importer;
-	const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs);
+	const aiScene* scene = importer.ReadFile(path, MODEL_IMPORT_FLAGS);
 
 	if (!scene || !scene->mRootNode || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE) {
 		std::cout << "ERROR::ASSIMP::" << importer.GetErrorString() << std::endl;
+		return false;
+	}
+
+	std::vector<aiMesh*> ai_meshes;
+	process_node(scene->mRootNode, scene, ai_meshes);
+
+	data.meshes.resize(ai_meshes.size());
+	auto convert = [&](size_t i) {
+		data.meshes[i] = process_mesh(ai_meshes[i], scene);
+	};
+	if (pool) {
+		pool->parallel_for(ai_meshes.size(), convert);
+	}
+	else {
+		for (size_t i = 0; i < ai_meshes.size(); i++) {
+			convert(i);
+		}
+	}
+	return true;
+}
+
+std::vector<Model> Model::load_models(const std::vector<std::string>& paths, ThreadPool& pool,
+	bool merged) {
+	std::vector<std::future<ModelData>> pending;
+	for (const std::string& path : paths) {
+		pending.push_back(pool.submit([path, &pool]() {
+			return import(path, &pool);
+		}));
+	}
+
+	std::vector<Model> models;
+	for (std::future<ModelData>& result : pending) {
+		ModelData data = result.get();
+		models.push_back(Model(data, merged));
+	}
+	return models;
+}
+
+std::shared_ptr<Model> Model::load_async(const std::string& path, ThreadPool& pool, UploadThread& uploader,
+	bool merged) {
+	std::shared_ptr<Model> model(new Model());
+	model->merged = merged;
+	pool.submit([model, path, merged, &pool, &uploader]() {
+		std::shared_ptr<ModelData> data = std::make_shared<ModelData>(import(path, &pool));
+		std::shared_ptr<std::vector<MeshBuffers>> buffers = std::make_shared<std::vector<MeshBuffers>>();
+		uploader.submit([data, buffers, merged]() {
+			*buffers = stream_buffers(*data, merged);
+		}, [model, data, buffers]() {
+			model->adopt_buffers(data->path, *buffers);
+		});
+	});
+	return model;
+}
+
+// Runs on the upload thread, or on the render thread for merged synchronous uploads.
+std::vector<Model::MeshBuffers> Model::stream_buffers(const ModelData& data, bool merged) {
+	TRACE_SCOPE("Model::stream_buffers");
+	std::vector<MeshBuffers> buffers;
+	if (merged && data.cache) {
+		// The cache already stores the submeshes back to back.
+		const MeshCache& cache = *data.cache;
+		const MeshCacheHeader& header = cache.header();
+		unsigned int VBO = stream_buffer(cache.vertices(), header.vertex_count * sizeof(Vertex));
+		unsigned int EBO = stream_buffer(cache.indices(), header.index_count * sizeof(unsigned int));
+		for (uint32_t i = 0; i < header.submesh_count; i++) {
+			const MeshCacheSubmesh& submesh = cache.submeshes()[i];
+			MeshBuffers mesh;
+			mesh.VBO = VBO;
+			mesh.EBO = EBO;
+			mesh.index_count = submesh.index_count;
+			mesh.first_index = submesh.first_index;
+			mesh.base_vertex = (int)submesh.first_vertex;
+			mesh.bounds = cache_bounds(submesh);
+			for (uint32_t j = 0; j < submesh.texture_count; j++) {
+				const MeshCacheTexture& texture = cache.textures()[submesh.first_texture + j];
+				mesh.textures.push_back({ (TextureType)texture.type, cache.texture_path(texture) });
+			}
+			buffers.push_back(mesh);
+		}
+		return buffers;
+	}
+
+	if (merged) {
+		std::vector<Vertex> vertices;
+		std::vector<unsigned int> indices;
+		for (const MeshData& data_mesh : data.meshes) {
+			MeshBuffers mesh;
+			mesh.index_count = data_mesh.indices.size();
+			mesh.first_index = indices.size();
+			mesh.base_vertex = (int)vertices.size();
+			mesh.textures = data_mesh.textures;
+			mesh.bounds = data_mesh.bounds;
+			buffers.push_back(mesh);
+			vertices.insert(vertices.end(), data_mesh.vertices.begin(), data_mesh.vertices.end());
+			indices.insert(indices.end(), data_mesh.indices.begin(), data_mesh.indices.end());
+		}
+		unsigned int VBO = stream_buffer(vertices.data(), vertices.size() * sizeof(Vertex));
+		unsigned int EBO = stream_buffer(indices.data(), indices.size() * sizeof(unsigned int));
+		for (MeshBuffers& mesh : buffers) {
+			mesh.VBO = VBO;
+			mesh.EBO = EBO;
+		}
+		return buffers;
+	}
+
+	if (data.cache) {
+		const MeshCache& cache = *data.cache;
+		for (uint32_t i = 0; i < cache.header().submesh_count; i++) {
+			const MeshCacheSubmesh& submesh = cache.submeshes()[i];
+			MeshBuffers mesh;
+			mesh.VBO = stream_buffer(cache.vertices() + (size_t)submesh.first_vertex * sizeof(Vertex),
+				submesh.vertex_count * sizeof(Vertex));
+			mesh.EBO = stream_buffer(cache.indices() + (size_t)submesh.first_index * sizeof(unsigned int),
+				submesh.index_count * sizeof(unsigned int));
+			mesh.index_count = submesh.index_count;
+			mesh.bounds = cache_bounds(submesh);
+			for (uint32_t j = 0; j < submesh.texture_count; j++) {
+				const MeshCacheTexture& texture = cache.textures()[submesh.first_texture + j];
+				mesh.textures.push_back({ (TextureType)texture.type, cache.texture_path(texture) });
+			}
+			buffers.push_back(mesh);
+		}
+		return buffers;
+	}
+
+	for (const MeshData& data_mesh : data.meshes) {
+		MeshBuffers mesh;
+		mesh.VBO = stream_buffer(data_mesh.vertices.data(), data_mesh.vertices.size() * sizeof(Vertex));
+		mesh.EBO = stream_buffer(data_mesh.indices.data(), data_mesh.indices.size() * sizeof(unsigned int));
+		mesh.index_count = data_mesh.indices.size();
+		mesh.textures = data_mesh.textures;
+		mesh.bounds = data_mesh.bounds;
+		buffers.push_back(mesh);
+	}
+	return buffers;
+}
+
+void Model::adopt_buffers(const std::string& path, const std::vector<MeshBuffers>& buffers) {
+	TRACE_SCOPE("Model::adopt_buffers");
+	directory_path = path.substr(0, path.find_last_of("/\\"));
+	name = path.substr(path.find_last_of("/\\") + 1);
+	if (merged && !buffers.empty()) {
+		VAO = create_vertex_array(buffers[0].VBO, buffers[0].EBO);
+	}
+	for (const MeshBuffers& mesh : buffers) {
+		std::vector<Texture> textures;
+		for (const TextureRef& ref : mesh.textures) {
+			textures.push_back(get_texture(ref.path, ref.type));
+		}
+		if (merged) {
+			meshes.push_back(Mesh(MeshRange{ VAO, mesh.first_index, mesh.index_count, mesh.base_vertex }, textures));
+		}
+		else {
+			meshes.push_back(Mesh(mesh.VBO, mesh.EBO, mesh.index_count, textures));
+		}
+		add_bounds(mesh.bounds);
+	}
+	if (merged) {
+		build_draw_groups();
+	}
+	ready = true;
+}
+
+void Model::upload(ModelData& data) {
+	TRACE_SCOPE("Model::upload");
+	if (merged) {
+		adopt_buffers(data.path, stream_buffers(data, true));
+		return;
+	}
+	directory_path = data.path.substr(0, data.path.find_last_of("/\\"));
+	name = data.path.substr(data.path.find_last_of("/\\") + 1);
+	ready = true;
+
+	if (data.cache) {
+		const MeshCache& cache = *data.cache;
+		const Vertex* vertices = (const Vertex*)cache.vertices();
+		const unsigned int* indices = (const unsigned int*)cache.indices();
+		for (uint32_t i = 0; i < cache.header().submesh_count; i++) {
+			const MeshCacheSubmesh& submesh = cache.submeshes()[i];
+			std::vector<Texture> textures;
+			for (uint32_t j = 0; j < submesh.texture_count; j++) {
+				const MeshCacheTexture& texture = cache.textures()[submesh.first_texture + j];
+				textures.push_back(get_texture(cache.texture_path(texture), (TextureType)texture.type));
+			}
+			meshes.push_back(Mesh(vertices + submesh.first_vertex, submesh.vertex_count,
+				indices + submesh.first_index, submesh.index_count, textures));
+			add_bounds(cache_bounds(submesh));
+		}
 		return;
 	}
 
-	directory_path = path.substr(0, path.find_last_of('\\'));
+	for (MeshData& mesh : data.meshes) {
+		std::vector<Texture> textures;
+		for (const TextureRef& ref : mesh.textures) {
+			textures.push_back(get_texture(ref.path, ref.type));
+		}
+		meshes.push_back(Mesh(std::move(mesh.vertices), std::move(mesh.indices), textures));
+		add_bounds(mesh.bounds);
+	}
+}
 
-	process_node(scene->mRootNode, scene);
+void Model::write_cache(const ModelData& data, uint64_t source_hash, uint32_t import_flags) {
+	MeshCacheWriter writer(sizeof(Vertex), sizeof(unsigned int));
+	for (const MeshData& mesh : data.meshes) {
+		writer.add_submesh(mesh.vertices.data(), mesh.vertices.size(), mesh.indices.data(), mesh.indices.size(),
+			&mesh.bounds.min.x, &mesh.bounds.max.x);
+		for (const TextureRef& texture : mesh.textures) {
+			writer.add_texture(texture.type, texture.path);
+		}
+	}
+	if (!writer.write(mesh_cache_path(data.path), source_hash, import_flags)) {
+		std::cout << "ERROR::MODEL::CACHE_WRITE_FAILED " << mesh_cache_path(data.path) << std::endl;
+	}
 }
 
-void Model::process_node(aiNode* node, const aiScene* scene) {
+void Model::process_node(aiNode* node, const aiScene* scene, std::vector<aiMesh*>& out) {
+	TRACE_SCOPE("Model::process_node");
 	for (unsigned int i = 0; i < node->mNumMeshes; i++) {
-		aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-		meshes.push_back(process_mesh(mesh, scene));
+		out.push_back(scene->mMeshes[node->mMeshes[i]]);
 	}
 
 	for (unsigned int i = 0; i < node->mNumChildren; i++) {
-		process_node(node->mChildren[i], scene);
+		process_node(node->mChildren[i], scene, out);
 	}
 }
 
-Mesh Model::process_mesh(aiMesh* mesh, const aiScene* scene) {
-	std::vector<Vertex> vertices;
-	std::vector<unsigned int> indices;
-	std::vector<Texture> textures;
+MeshData Model::process_mesh(aiMesh* mesh, const aiScene* scene) {
+	TRACE_SCOPE("Model::process_mesh");
+	MeshData data;
+	std::vector<Vertex>& vertices = data.vertices;
+	std::vector<unsigned int>& indices = data.indices;
+	std::vector<TextureRef>& textures = data.textures;
+
+	vertices.reserve(mesh->mNumVertices);
+	indices.reserve(mesh->mNumFaces * 3);
 
 	// Vertex
 	for (unsigned int i = 0; i < mesh->mNumVertices; i++) {
@@ -85,6 +805,7 @@ Mesh Model::process_mesh(aiMesh* mesh, const aiScene* scene) {
 		vec.y = mesh->mVertices[i].y;
 		vec.z = mesh->mVertices[i].z;
 		vertex.Position = vec;
+		data.bounds.expand(vec);
 		
 		vec.x = mesh->mNormals[i].x;
 		vec.y = mesh->mNormals[i].y;
@@ -106,7 +827,7 @@ Mesh Model::process_mesh(aiMesh* mesh, const aiScene* scene) {
 
 	// Indices
 	for (unsigned int i = 0; i < mesh->mNumFaces; i++) {
-		aiFace face = mesh->mFaces[i];
+		const aiFace& face = mesh->mFaces[i];
 		for (unsigned int j = 0; j < face.mNumIndices; j++) {
 			indices.push_back(face.mIndices[j]);
 		}
@@ -116,75 +837,28 @@ Mesh Model::process_mesh(aiMesh* mesh, const aiScene* scene) {
 	if (mesh->mMaterialIndex >= 0) {
 		aiMaterial* mat = scene->mMaterials[mesh->mMaterialIndex];
 
-		std::vector<Texture> diffuse_maps = load_material_texture(mat, aiTextureType_DIFFUSE,
-			TextureType::DIFFUSE);
-		textures.insert(textures.end(), diffuse_maps.begin(), diffuse_maps.end());
-
-		std::vector<Texture> specular_maps = load_material_texture(mat, aiTextureType_SPECULAR,
-			TextureType::SPECULAR);
-		textures.insert(textures.end(), specular_maps.begin(), specular_maps.end());
-
-		std::vector<Texture> emission_maps = load_material_texture(mat, aiTextureType_EMISSIVE,
-			TextureType::EMISSION);
-		textures.insert(textures.end(), emission_maps.begin(), emission_maps.end());
+		load_material_texture(mat, aiTextureType_DIFFUSE, TextureType::DIFFUSE, textures);
+		load_material_texture(mat, aiTextureType_SPECULAR, TextureType::SPECULAR, textures);
+		load_material_texture(mat, aiTextureType_EMISSIVE, TextureType::EMISSION, textures);
 	}
-	return Mesh(vertices, indices, textures);
+	return data;
 }
 
-std::vector<Texture> Model::load_material_texture(aiMaterial* mat,
-	aiTextureType type, TextureType type_name) {
+void Model::load_material_texture(aiMaterial* mat, aiTextureType type,
+	TextureType type_name, std::vector<TextureRef>& textures) {
 
-	std::vector<Texture> textures;
 	for (unsigned int i = 0; i < mat->GetTextureCount(type); i++) {
 		aiString str;
 		mat->GetTexture(type, i, &str);
-		bool skip = false;
-
-		for (unsigned int j = 0; j < textures_loaded.size(); j++) {
-			if (std::strcmp(textures_loaded[j].path.data(), str.C_Str()) == 0) {
-				textures.push_back(textures_loaded[j]);
-				skip = true;
-				break;
-			}
-		}
-
-		if (!skip) {
-			Texture tex;
-			load_texture(directory_path + '\\' + str.C_Str(), &tex.id);
-			tex.type = type_name;
-			tex.path = str.C_Str();
-			textures.push_back(tex);
-			textures_loaded.push_back(tex);
-		}
+		textures.push_back({ type_name, str.C_Str() });
 	}
-	return textures;
-
 }
 
-void load_texture(const std::string& texture_path, unsigned int *id) {
-	glGenTextures(1, id);
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, *id);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	load_from_image(texture_path);
-	return;
-}
-
-void load_from_image(const std::string& texture_path) {
-	int width, height, nrChannels;
-	stbi_set_flip_vertically_on_load(1);
-	unsigned char* data = stbi_load(texture_path.c_str(), &width, &height,
-		&nrChannels, 0);
-	if (data) {
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB,
-			GL_UNSIGNED_BYTE, data);
-		glGenerateMipmap(GL_TEXTURE_2D);
-	}
-	else {
-		std::cout << "ERROR::TEXTURE::LOAD_FAILED" << std::endl;
-	}
-	stbi_image_free(data);
+Texture Model::get_texture(const std::string& path, TextureType type_name) {
+	Texture tex;
+	tex.handle = TextureCache::instance().get(directory_path + '/' + path);
+	tex.id = tex.handle->id;
+	tex.type = type_name;
+	tex.path = path;
+	return tex;
 }
\ No newline at end of file
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <atomic>
+#include <utility>
+
+// Lock-free multi producer, single consumer queue (Vyukov). push from any thread, pop from one.
+template<typename T>
+class MpscQueue {
+public:
+    MpscQueue();
+    ~MpscQueue();
+    MpscQueue(const MpscQueue&) = delete;
+    MpscQueue& operator=(const MpscQueue&) = delete;
+
+    void push(T value);
+    bool pop(T& value);
+private:
+    struct Node {
+        std::atomic<Node*> next{ nullptr };
+        T value;
+    };
+
+    std::atomic<Node*> head;
+    Node* tail;
+};
+
+template<typename T>
+MpscQueue<T>::MpscQueue() {
+    Node* stub = new Node();
+    head.store(stub, std::memory_order_relaxed);
+    tail = stub;
+}
+
+template<typename T>
+MpscQueue<T>::~MpscQueue() {
+    T value;
+    while (pop(value)) {
+    }
+    delete tail;
+}
+
+template<typename T>
+void MpscQueue<T>::push(T value) {
+    Node* node = new Node();
+    node->value = std::move(value);
+    Node* prev = head.exchange(node, std::memory_order_acq_rel);
+    prev->next.store(node, std::memory_order_release);
+}
+
+template<typename T>
+bool MpscQueue<T>::pop(T& value) {
+    Node* next = tail->next.load(std::memory_order_acquire);
+    if (next == nullptr) {
+        return false;
+    }
+    value = std::move(next->value);
+    delete tail;
+    tail = next;
+    return true;
+}
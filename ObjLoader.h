@@ -0,0 +1,389 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <MappedFile.h>
+#include <Bounds.h>
+
+#include <vector>
+#include <string>
+#include <cstring>
+#include <charconv>
+#include <thread>
+#include <algorithm>
+#include <unordered_map>
+#include <cstdint>
+
+// Indices into ObjData arrays, 0 based. -1 when the face corner has no such attribute.
+struct ObjIndex {
+    int position;
+    int texcoord;
+    int normal;
+};
+
+// Corners from first_corner on use the material, up to the next range.
+struct ObjMaterialRange {
+    std::string material;
+    size_t first_corner;
+};
+
+struct ObjData {
+    std::vector<glm::vec3> positions;
+    std::vector<glm::vec3> normals;
+    std::vector<glm::vec2> texcoords;
+    std::vector<ObjIndex> corners; // three per triangle, polygons are fan triangulated
+    std::vector<ObjMaterialRange> materials; // one per usemtl line, in file order
+    std::vector<std::string> material_libraries; // mtllib file names as written, relative to the OBJ
+    AABB bounds; // of the positions, filled in by load_obj
+};
+
+// Texture maps of a material, file names as written in the MTL, empty when absent.
+struct ObjMaterial {
+    std::string name;
+    std::string diffuse_map;
+    std::string specular_map;
+    std::string emission_map;
+};
+
+// Corner whose indices were negative (relative) and resolved against counts local to a chunk.
+// mask bit 0: position, bit 1: texcoord, bit 2: normal.
+struct ObjFixup {
+    size_t corner;
+    unsigned int mask;
+};
+
+// threads == 0 uses every hardware thread. The result is identical for any thread count.
+bool load_obj(const std::string& path, ObjData& out, unsigned int threads = 1);
+bool parse_obj(const char* begin, const char* end, ObjData& out, std::vector<ObjFixup>* fixups = nullptr);
+bool parse_obj_parallel(const char* begin, const char* end, ObjData& out, unsigned int threads);
+// Collapses face corners with the same (position, texcoord, normal) triple into one vertex.
+void weld_obj(const ObjData& data, std::vector<ObjIndex>& unique, std::vector<unsigned int>& indices);
+// Same for the count corners from first on, e.g. one material range.
+void weld_obj(const ObjData& data, size_t first, size_t count, std::vector<ObjIndex>& unique,
+    std::vector<unsigned int>& indices);
+// Appends the materials of an MTL file.
+bool load_mtl(const std::string& path, std::vector<ObjMaterial>& out);
+void parse_mtl(const char* begin, const char* end, std::vector<ObjMaterial>& out);
+// mtllib file names of an OBJ file without parsing the rest, e.g. to hash what an import depends on.
+std::vector<std::string> find_material_libraries(const char* begin, const char* end);
+
+namespace obj {
+    const char* skip_space(const char* p, const char* end) {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) {
+            p++;
+        }
+        return p;
+    }
+
+    const char* next_line(const char* p, const char* end) {
+        const char* nl = (const char*)std::memchr(p, '\n', end - p);
+        return nl ? nl + 1 : end;
+    }
+
+    const char* parse_float(const char* p, const char* end, float& value) {
+        p = skip_space(p, end);
+        if (p < end && *p == '+') {
+            p++;
+        }
+        std::from_chars_result res = std::from_chars(p, end, value);
+        if (res.ec != std::errc()) {
+            value = 0.0f;
+            return p;
+        }
+        return res.ptr;
+    }
+
+    // OBJ indices are 1 based, negative values count back from the last element read.
+    int resolve_index(int index, size_t count) {
+        if (index > 0) {
+            return index - 1;
+        }
+        if (index < 0) {
+            return (int)count + index;
+        }
+        return -1;
+    }
+
+    // Chunks smaller than this are not worth a thread.
+    const size_t MIN_CHUNK_BYTES = 1 << 20;
+
+    struct Corner {
+        ObjIndex index;
+        unsigned int relative;
+    };
+
+    // Parses "v", "v/t", "v//n" or "v/t/n". Returns nullptr when no corner is left on the line.
+    const char* parse_corner(const char* p, const char* end, const ObjData& data, Corner& corner) {
+        p = skip_space(p, end);
+        if (p == end || *p == '\n' || *p == '#') {
+            return nullptr;
+        }
+        int v = 0, t = 0, n = 0;
+        std::from_chars_result res = std::from_chars(p, end, v);
+        if (res.ec != std::errc()) {
+            return nullptr;
+        }
+        p = res.ptr;
+        if (p < end && *p == '/') {
+            p++;
+            if (p < end && *p != '/') {
+                res = std::from_chars(p, end, t);
+                p = res.ptr;
+            }
+            if (p < end && *p == '/') {
+                p++;
+                res = std::from_chars(p, end, n);
+                p = res.ptr;
+            }
+        }
+        corner.index.position = resolve_index(v, data.positions.size());
+        corner.index.texcoord = resolve_index(t, data.texcoords.size());
+        corner.index.normal = resolve_index(n, data.normals.size());
+        corner.relative = (v < 0 ? 1u : 0u) | (t < 0 ? 2u : 0u) | (n < 0 ? 4u : 0u);
+        return p;
+    }
+
+    struct IndexHash {
+        size_t operator()(const ObjIndex& i) const {
+            // Mixed in 64 bits on every target, a 32-bit size_t would cut the constants in half.
+            uint64_t h = (uint64_t)(uint32_t)i.position * 0x9E3779B97F4A7C15ull;
+            h ^= (uint64_t)(uint32_t)i.texcoord * 0xC2B2AE3D27D4EB4Full + (h << 6) + (h >> 2);
+            h ^= (uint64_t)(uint32_t)i.normal * 0x165667B19E3779F9ull + (h << 6) + (h >> 2);
+            return (size_t)(h ^ (h >> 32));
+        }
+    };
+
+    struct IndexEqual {
+        bool operator()(const ObjIndex& a, const ObjIndex& b) const {
+            return a.position == b.position && a.texcoord == b.texcoord && a.normal == b.normal;
+        }
+    };
+
+    // Rest of the line without surrounding blanks, for names that may contain spaces.
+    std::string rest_of_line(const char* p, const char* end) {
+        p = skip_space(p, end);
+        const char* line_end = (const char*)std::memchr(p, '\n', end - p);
+        line_end = line_end ? line_end : end;
+        while (line_end > p && (line_end[-1] == ' ' || line_end[-1] == '\t' || line_end[-1] == '\r')) {
+            line_end--;
+        }
+        return std::string(p, line_end);
+    }
+
+    // True when the line at p starts with keyword followed by a blank.
+    bool is_keyword(const char* p, const char* end, const char* keyword) {
+        size_t length = std::strlen(keyword);
+        return (size_t)(end - p) > length && std::memcmp(p, keyword, length) == 0 &&
+            (p[length] == ' ' || p[length] == '\t');
+    }
+
+    void push_corner(ObjData& out, const Corner& corner, std::vector<ObjFixup>* fixups) {
+        if (fixups && corner.relative) {
+            fixups->push_back({ out.corners.size(), corner.relative });
+        }
+        out.corners.push_back(corner.index);
+    }
+}
+
+bool load_obj(const std::string& path, ObjData& out, unsigned int threads) {
+    MappedFile file(path);
+    if (!file.is_open()) {
+        return false;
+    }
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    bool parsed = threads > 1 ? parse_obj_parallel(file.begin(), file.end(), out, threads) :
+        parse_obj(file.begin(), file.end(), out);
+    out.bounds = AABB();
+    for (const glm::vec3& position : out.positions) {
+        out.bounds.expand(position);
+    }
+    return parsed;
+}
+
+bool parse_obj(const char* begin, const char* end, ObjData& out, std::vector<ObjFixup>* fixups) {
+    const char* p = begin;
+    while (p < end) {
+        p = obj::skip_space(p, end);
+        if (p == end) {
+            break;
+        }
+        if (p[0] == 'v' && p + 1 < end) {
+            glm::vec3 v(0.0f);
+            if (p[1] == ' ' || p[1] == '\t') {
+                p = obj::parse_float(p + 2, end, v.x);
+                p = obj::parse_float(p, end, v.y);
+                p = obj::parse_float(p, end, v.z);
+                out.positions.push_back(v);
+            }
+            else if (p[1] == 'n') {
+                p = obj::parse_float(p + 2, end, v.x);
+                p = obj::parse_float(p, end, v.y);
+                p = obj::parse_float(p, end, v.z);
+                out.normals.push_back(v);
+            }
+            else if (p[1] == 't') {
+                p = obj::parse_float(p + 2, end, v.x);
+                p = obj::parse_float(p, end, v.y);
+                out.texcoords.push_back(glm::vec2(v.x, v.y));
+            }
+        }
+        else if (p[0] == 'f' && p + 1 < end && (p[1] == ' ' || p[1] == '\t')) {
+            obj::Corner first, prev, cur;
+            const char* q = obj::parse_corner(p + 2, end, out, first);
+            q = q ? obj::parse_corner(q, end, out, prev) : nullptr;
+            while (q && (q = obj::parse_corner(q, end, out, cur))) {
+                obj::push_corner(out, first, fixups);
+                obj::push_corner(out, prev, fixups);
+                obj::push_corner(out, cur, fixups);
+                prev = cur;
+            }
+        }
+        else if (obj::is_keyword(p, end, "usemtl")) {
+            out.materials.push_back({ obj::rest_of_line(p + 6, end), out.corners.size() });
+        }
+        else if (obj::is_keyword(p, end, "mtllib")) {
+            out.material_libraries.push_back(obj::rest_of_line(p + 6, end));
+        }
+        p = obj::next_line(p, end);
+    }
+    return true;
+}
+
+// Splits the range on line boundaries and parses each chunk on its own thread. Relative indices
+// are resolved per chunk and shifted by the element counts of the preceding chunks when merging.
+bool parse_obj_parallel(const char* begin, const char* end, ObjData& out, unsigned int threads) {
+    size_t size = end - begin;
+    threads = (unsigned int)std::min<size_t>(threads, std::max<size_t>(1, size / obj::MIN_CHUNK_BYTES));
+    if (threads <= 1) {
+        return parse_obj(begin, end, out);
+    }
+
+    std::vector<const char*> bounds(threads + 1);
+    bounds[0] = begin;
+    bounds[threads] = end;
+    for (unsigned int i = 1; i < threads; i++) {
+        const char* split = std::max(bounds[i - 1], begin + size / threads * i);
+        bounds[i] = split == begin ? begin : obj::next_line(split - 1, end);
+    }
+
+    std::vector<ObjData> chunks(threads);
+    std::vector<std::vector<ObjFixup>> fixups(threads);
+    std::vector<std::thread> workers;
+    for (unsigned int i = 0; i < threads; i++) {
+        workers.emplace_back([&, i]() {
+            parse_obj(bounds[i], bounds[i + 1], chunks[i], &fixups[i]);
+        });
+    }
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+
+    // Element offsets of every chunk in the merged arrays.
+    std::vector<ObjIndex> base(threads + 1);
+    std::vector<size_t> corner_base(threads + 1);
+    base[0] = { (int)out.positions.size(), (int)out.texcoords.size(), (int)out.normals.size() };
+    corner_base[0] = out.corners.size();
+    for (unsigned int i = 0; i < threads; i++) {
+        base[i + 1].position = base[i].position + (int)chunks[i].positions.size();
+        base[i + 1].texcoord = base[i].texcoord + (int)chunks[i].texcoords.size();
+        base[i + 1].normal = base[i].normal + (int)chunks[i].normals.size();
+        corner_base[i + 1] = corner_base[i] + chunks[i].corners.size();
+    }
+    out.positions.resize(base[threads].position);
+    out.texcoords.resize(base[threads].texcoord);
+    out.normals.resize(base[threads].normal);
+    out.corners.resize(corner_base[threads]);
+
+    workers.clear();
+    for (unsigned int i = 0; i < threads; i++) {
+        workers.emplace_back([&, i]() {
+            ObjData& chunk = chunks[i];
+            std::copy(chunk.positions.begin(), chunk.positions.end(), out.positions.begin() + base[i].position);
+            std::copy(chunk.texcoords.begin(), chunk.texcoords.end(), out.texcoords.begin() + base[i].texcoord);
+            std::copy(chunk.normals.begin(), chunk.normals.end(), out.normals.begin() + base[i].normal);
+            for (const ObjFixup& fix : fixups[i]) {
+                ObjIndex& c = chunk.corners[fix.corner];
+                c.position += (fix.mask & 1u) ? base[i].position : 0;
+                c.texcoord += (fix.mask & 2u) ? base[i].texcoord : 0;
+                c.normal += (fix.mask & 4u) ? base[i].normal : 0;
+            }
+            std::copy(chunk.corners.begin(), chunk.corners.end(), out.corners.begin() + corner_base[i]);
+        });
+    }
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    // Corners before a chunk's first usemtl carry on with the material the chunk before ended on.
+    for (unsigned int i = 0; i < threads; i++) {
+        for (const ObjMaterialRange& range : chunks[i].materials) {
+            out.materials.push_back({ range.material, range.first_corner + corner_base[i] });
+        }
+        out.material_libraries.insert(out.material_libraries.end(), chunks[i].material_libraries.begin(),
+            chunks[i].material_libraries.end());
+    }
+    return true;
+}
+
+void weld_obj(const ObjData& data, std::vector<ObjIndex>& unique, std::vector<unsigned int>& indices) {
+    weld_obj(data, 0, data.corners.size(), unique, indices);
+}
+
+void weld_obj(const ObjData& data, size_t first, size_t count, std::vector<ObjIndex>& unique,
+    std::vector<unsigned int>& indices) {
+    std::unordered_map<ObjIndex, unsigned int, obj::IndexHash, obj::IndexEqual> lookup;
+    lookup.reserve(std::min(data.positions.size(), count));
+    indices.reserve(indices.size() + count);
+    for (size_t i = first; i < first + count; i++) {
+        const ObjIndex& corner = data.corners[i];
+        auto it = lookup.emplace(corner, (unsigned int)unique.size());
+        if (it.second) {
+            unique.push_back(corner);
+        }
+        indices.push_back(it.first->second);
+    }
+}
+
+bool load_mtl(const std::string& path, std::vector<ObjMaterial>& out) {
+    MappedFile file(path);
+    if (!file.is_open()) {
+        return false;
+    }
+    parse_mtl(file.begin(), file.end(), out);
+    return true;
+}
+
+void parse_mtl(const char* begin, const char* end, std::vector<ObjMaterial>& out) {
+    const char* p = begin;
+    while (p < end) {
+        p = obj::skip_space(p, end);
+        if (obj::is_keyword(p, end, "newmtl")) {
+            out.push_back(ObjMaterial());
+            out.back().name = obj::rest_of_line(p + 6, end);
+        }
+        else if (!out.empty() && obj::is_keyword(p, end, "map_Kd")) {
+            out.back().diffuse_map = obj::rest_of_line(p + 6, end);
+        }
+        else if (!out.empty() && obj::is_keyword(p, end, "map_Ks")) {
+            out.back().specular_map = obj::rest_of_line(p + 6, end);
+        }
+        else if (!out.empty() && obj::is_keyword(p, end, "map_Ke")) {
+            out.back().emission_map = obj::rest_of_line(p + 6, end);
+        }
+        p = obj::next_line(p, end);
+    }
+}
+
+std::vector<std::string> find_material_libraries(const char* begin, const char* end) {
+    std::vector<std::string> libraries;
+    const char* p = begin;
+    while (p < end) {
+        p = obj::skip_space(p, end);
+        if (p < end && *p == 'm' && obj::is_keyword(p, end, "mtllib")) {
+            libraries.push_back(obj::rest_of_line(p + 6, end));
+        }
+        p = obj::next_line(p, end);
+    }
+    return libraries;
+}
@@ -0,0 +1,356 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <Bounds.h>
+#include <Frustum.h>
+#include <ObjLoader.h>
+#include <ThreadPool.h>
+#include <Trace.h>
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+
+// Size of the CPU depth buffer. Small on purpose: it only has to tell big occluders from what they hide.
+const int OCCLUSION_WIDTH = 256;
+const int OCCLUSION_HEIGHT = 144;
+// Pixels per side of the tiles that keep a min and max depth. Rows of tiles are also the bands the
+// rasterizer splits across threads.
+const int OCCLUSION_TILE = 8;
+// Slack in the depth comparison, so a box is never hidden by the occluder drawn from its own surface.
+const float OCCLUSION_DEPTH_BIAS = 1e-4f;
+
+// Low-poly stand-in for a model, drawn into the occlusion buffer. It must lie inside what it stands for,
+// or it hides things the real model doesn't.
+struct OccluderMesh {
+    std::vector<glm::vec3> positions;
+    std::vector<unsigned int> indices;
+};
+
+// Positions and faces of an OBJ file as an occluder.
+bool load_occluder(const std::string& path, OccluderMesh& out);
+
+// Software hierarchical depth buffer for occlusion culling. Occluders are transformed and set up on the
+// calling thread, then rasterized in bands of tile rows, one band per ThreadPool task, four pixels at a
+// time with SSE. Only the nearest depth is kept, which is all a conservative visibility test needs.
+// Afterwards every tile stores the nearest and the farthest depth in it.
+//
+// A box is tested by its screen rectangle and its nearest depth: tiles entirely behind it are skipped,
+// a tile with anything behind the box's front makes it visible, and only tiles in between are checked
+// pixel by pixel.
+//
+// Depth is window depth, 0 at the near plane and 1 at the far plane. Triangles crossing the near plane
+// are dropped rather than clipped, losing occlusion but never wrongly hiding anything.
+class OcclusionBuffer {
+public:
+    OcclusionBuffer(int width = OCCLUSION_WIDTH, int height = OCCLUSION_HEIGHT);
+
+    int get_width() const { return width; }
+    int get_height() const { return height; }
+    // The scalar rasterizer, for comparison and for builds without SSE.
+    void set_simd(bool simd) { this->simd = simd; }
+
+    // Empties the buffer and forgets the occluders.
+    void clear();
+    void add_occluder(const OccluderMesh& mesh, const glm::mat4& model_view_projection);
+    void add_occluder(const glm::vec3* positions, const unsigned int* indices, size_t index_count,
+        const glm::mat4& model_view_projection);
+    // Rasterizes the occluders added since clear(), on the pool if there is one.
+    void render(ThreadPool* pool = nullptr);
+    // False when the box is certainly hidden behind the rendered occluders.
+    bool is_visible(const AABB& box, const glm::mat4& model_view_projection) const;
+
+    // Triangles that survived setup since clear().
+    size_t triangle_count() const { return triangles.size(); }
+    float depth_at(int x, int y) const { return depth[(size_t)y * width + x]; }
+    const std::vector<float>& get_depth() const { return depth; }
+    // Greyscale dump of the depth buffer, near is dark, top row first.
+    bool write_pgm(const std::string& path) const;
+private:
+    // Edge functions and depth plane in pixel units, evaluated at pixel centres.
+    struct Triangle {
+        float edge_a[3], edge_b[3], edge_c[3];
+        float depth_a, depth_b, depth_c;
+        int min_x, min_y, max_x, max_y;
+    };
+
+    int width, height;
+    int tiles_x, tiles_y;
+    bool simd = true;
+    std::vector<Triangle> triangles;
+    std::vector<float> depth;
+    std::vector<float> tile_min, tile_max;
+
+    bool setup(const glm::vec4* clip, Triangle& triangle) const;
+    void render_band(int tile_row);
+    void rasterize_scalar(const Triangle& triangle, int first_row, int last_row);
+#ifdef FRUSTUM_X86
+    void rasterize_sse(const Triangle& triangle, int first_row, int last_row);
+#endif
+};
+
+bool load_occluder(const std::string& path, OccluderMesh& out) {
+    ObjData data;
+    if (!load_obj(path, data)) {
+        std::cout << "ERROR::OCCLUSION::OCCLUDER_NOT_LOADED " << path << std::endl;
+        return false;
+    }
+    out.positions = std::move(data.positions);
+    out.indices.clear();
+    out.indices.reserve(data.corners.size());
+    for (const ObjIndex& corner : data.corners) {
+        if (corner.position < 0 || (size_t)corner.position >= out.positions.size()) {
+            std::cout << "ERROR::OCCLUSION::BAD_OCCLUDER_INDEX " << path << std::endl;
+            return false;
+        }
+        out.indices.push_back((unsigned int)corner.position);
+    }
+    return true;
+}
+
+OcclusionBuffer::OcclusionBuffer(int width, int height) {
+    // Rows are written four pixels at a time.
+    this->width = (width + 3) & ~3;
+    this->height = height;
+    tiles_x = (this->width + OCCLUSION_TILE - 1) / OCCLUSION_TILE;
+    tiles_y = (height + OCCLUSION_TILE - 1) / OCCLUSION_TILE;
+    depth.assign((size_t)this->width * height, 1.0f);
+    tile_min.assign((size_t)tiles_x * tiles_y, 1.0f);
+    tile_max.assign((size_t)tiles_x * tiles_y, 1.0f);
+}
+
+void OcclusionBuffer::clear() {
+    triangles.clear();
+    std::fill(depth.begin(), depth.end(), 1.0f);
+    std::fill(tile_min.begin(), tile_min.end(), 1.0f);
+    std::fill(tile_max.begin(), tile_max.end(), 1.0f);
+}
+
+void OcclusionBuffer::add_occluder(const OccluderMesh& mesh, const glm::mat4& model_view_projection) {
+    add_occluder(mesh.positions.data(), mesh.indices.data(), mesh.indices.size(), model_view_projection);
+}
+
+void OcclusionBuffer::add_occluder(const glm::vec3* positions, const unsigned int* indices, size_t index_count,
+    const glm::mat4& model_view_projection) {
+    TRACE_SCOPE("OcclusionBuffer::add_occluder");
+    for (size_t i = 0; i + 2 < index_count; i += 3) {
+        glm::vec4 clip[3];
+        for (int v = 0; v < 3; v++) {
+            clip[v] = model_view_projection * glm::vec4(positions[indices[i + v]], 1.0f);
+        }
+        Triangle triangle;
+        if (setup(clip, triangle)) {
+            triangles.push_back(triangle);
+        }
+    }
+}
+
+bool OcclusionBuffer::setup(const glm::vec4* clip, Triangle& triangle) const {
+    glm::vec3 screen[3];
+    for (int v = 0; v < 3; v++) {
+        if (clip[v].z < -clip[v].w || clip[v].w <= 0.0f) {
+            return false;
+        }
+        glm::vec3 ndc = glm::vec3(clip[v]) / clip[v].w;
+        screen[v] = glm::vec3((ndc.x * 0.5f + 0.5f) * width, (ndc.y * 0.5f + 0.5f) * height, ndc.z * 0.5f + 0.5f);
+    }
+    float area = (screen[1].x - screen[0].x) * (screen[2].y - screen[0].y) -
+        (screen[1].y - screen[0].y) * (screen[2].x - screen[0].x);
+    if (area == 0.0f || std::isnan(area)) {
+        return false;
+    }
+    // Occluders are drawn two sided, clockwise triangles are turned around.
+    if (area < 0.0f) {
+        std::swap(screen[1], screen[2]);
+        area = -area;
+    }
+    triangle.min_x = std::max(0, (int)std::floor(std::min({ screen[0].x, screen[1].x, screen[2].x })));
+    triangle.min_y = std::max(0, (int)std::floor(std::min({ screen[0].y, screen[1].y, screen[2].y })));
+    triangle.max_x = std::min(width - 1, (int)std::ceil(std::max({ screen[0].x, screen[1].x, screen[2].x })));
+    triangle.max_y = std::min(height - 1, (int)std::ceil(std::max({ screen[0].y, screen[1].y, screen[2].y })));
+    if (triangle.min_x > triangle.max_x || triangle.min_y > triangle.max_y) {
+        return false;
+    }
+    // Edge i runs from vertex i to the next one and is >= 0 on the inside. Edge i is also the barycentric
+    // weight of the vertex opposite it, which gives the depth plane.
+    for (int e = 0; e < 3; e++) {
+        const glm::vec3& a = screen[e];
+        const glm::vec3& b = screen[(e + 1) % 3];
+        triangle.edge_a[e] = a.y - b.y;
+        triangle.edge_b[e] = b.x - a.x;
+        triangle.edge_c[e] = -(triangle.edge_a[e] * a.x + triangle.edge_b[e] * a.y);
+    }
+    float z[3] = { screen[2].z / area, screen[0].z / area, screen[1].z / area };
+    triangle.depth_a = triangle.edge_a[0] * z[0] + triangle.edge_a[1] * z[1] + triangle.edge_a[2] * z[2];
+    triangle.depth_b = triangle.edge_b[0] * z[0] + triangle.edge_b[1] * z[1] + triangle.edge_b[2] * z[2];
+    triangle.depth_c = triangle.edge_c[0] * z[0] + triangle.edge_c[1] * z[1] + triangle.edge_c[2] * z[2];
+    return true;
+}
+
+void OcclusionBuffer::render(ThreadPool* pool) {
+    TRACE_SCOPE("OcclusionBuffer::render");
+    if (pool) {
+        pool->parallel_for((size_t)tiles_y, [this](size_t row) { render_band((int)row); });
+    }
+    else {
+        for (int row = 0; row < tiles_y; row++) {
+            render_band(row);
+        }
+    }
+}
+
+void OcclusionBuffer::render_band(int tile_row) {
+    int first_row = tile_row * OCCLUSION_TILE;
+    int last_row = std::min(height - 1, first_row + OCCLUSION_TILE - 1);
+    for (const Triangle& triangle : triangles) {
+        if (triangle.max_y < first_row || triangle.min_y > last_row) {
+            continue;
+        }
+#ifdef FRUSTUM_X86
+        if (simd) {
+            rasterize_sse(triangle, std::max(first_row, triangle.min_y), std::min(last_row, triangle.max_y));
+            continue;
+        }
+#endif
+        rasterize_scalar(triangle, std::max(first_row, triangle.min_y), std::min(last_row, triangle.max_y));
+    }
+
+    for (int tx = 0; tx < tiles_x; tx++) {
+        float nearest = 1.0f, farthest = 0.0f;
+        int last_x = std::min(width - 1, (tx + 1) * OCCLUSION_TILE - 1);
+        for (int y = first_row; y <= last_row; y++) {
+            const float* row = depth.data() + (size_t)y * width;
+            for (int x = tx * OCCLUSION_TILE; x <= last_x; x++) {
+                nearest = std::min(nearest, row[x]);
+                farthest = std::max(farthest, row[x]);
+            }
+        }
+        tile_min[(size_t)tile_row * tiles_x + tx] = nearest;
+        tile_max[(size_t)tile_row * tiles_x + tx] = farthest;
+    }
+}
+
+void OcclusionBuffer::rasterize_scalar(const Triangle& t, int first_row, int last_row) {
+    for (int y = first_row; y <= last_row; y++) {
+        float py = y + 0.5f;
+        float* row = depth.data() + (size_t)y * width;
+        for (int x = t.min_x; x <= t.max_x; x++) {
+            float px = x + 0.5f;
+            // Same order of operations as the SSE path, so both give the same depths.
+            float e0 = t.edge_a[0] * px + (t.edge_b[0] * py + t.edge_c[0]);
+            float e1 = t.edge_a[1] * px + (t.edge_b[1] * py + t.edge_c[1]);
+            float e2 = t.edge_a[2] * px + (t.edge_b[2] * py + t.edge_c[2]);
+            if (e0 >= 0.0f && e1 >= 0.0f && e2 >= 0.0f) {
+                float z = t.depth_a * px + (t.depth_b * py + t.depth_c);
+                row[x] = std::min(row[x], z);
+            }
+        }
+    }
+}
+
+#ifdef FRUSTUM_X86
+void OcclusionBuffer::rasterize_sse(const Triangle& t, int first_row, int last_row) {
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 lane = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+    __m128 a0 = _mm_set1_ps(t.edge_a[0]), a1 = _mm_set1_ps(t.edge_a[1]), a2 = _mm_set1_ps(t.edge_a[2]);
+    __m128 depth_a = _mm_set1_ps(t.depth_a);
+    int first_x = t.min_x & ~3;
+    for (int y = first_row; y <= last_row; y++) {
+        float py = y + 0.5f;
+        // The y part of each plane is constant along the row.
+        __m128 b0 = _mm_set1_ps(t.edge_b[0] * py + t.edge_c[0]);
+        __m128 b1 = _mm_set1_ps(t.edge_b[1] * py + t.edge_c[1]);
+        __m128 b2 = _mm_set1_ps(t.edge_b[2] * py + t.edge_c[2]);
+        __m128 depth_b = _mm_set1_ps(t.depth_b * py + t.depth_c);
+        float* row = depth.data() + (size_t)y * width;
+        for (int x = first_x; x <= t.max_x; x += 4) {
+            __m128 px = _mm_add_ps(_mm_set1_ps((float)x), lane);
+            __m128 e0 = _mm_add_ps(_mm_mul_ps(a0, px), b0);
+            __m128 e1 = _mm_add_ps(_mm_mul_ps(a1, px), b1);
+            __m128 e2 = _mm_add_ps(_mm_mul_ps(a2, px), b2);
+            __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_cmpge_ps(e1, zero)),
+                _mm_cmpge_ps(e2, zero));
+            if (_mm_movemask_ps(inside) == 0) {
+                continue;
+            }
+            __m128 z = _mm_add_ps(_mm_mul_ps(depth_a, px), depth_b);
+            __m128 old = _mm_loadu_ps(row + x);
+            __m128 nearest = _mm_min_ps(old, z);
+            _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearest), _mm_andnot_ps(inside, old)));
+        }
+    }
+}
+#endif
+
+bool OcclusionBuffer::is_visible(const AABB& box, const glm::mat4& model_view_projection) const {
+    if (box.is_empty()) {
+        return false;
+    }
+    glm::vec2 low(FLT_MAX), high(-FLT_MAX);
+    float nearest = FLT_MAX;
+    for (int i = 0; i < 8; i++) {
+        glm::vec3 corner((i & 1) ? box.max.x : box.min.x, (i & 2) ? box.max.y : box.min.y,
+            (i & 4) ? box.max.z : box.min.z);
+        glm::vec4 clip = model_view_projection * glm::vec4(corner, 1.0f);
+        // Reaches in front of the near plane, where nothing was rasterized.
+        if (clip.z < -clip.w || clip.w <= 0.0f) {
+            return true;
+        }
+        glm::vec3 ndc = glm::vec3(clip) / clip.w;
+        glm::vec2 screen((ndc.x * 0.5f + 0.5f) * width, (ndc.y * 0.5f + 0.5f) * height);
+        low = glm::min(low, screen);
+        high = glm::max(high, screen);
+        nearest = std::min(nearest, ndc.z * 0.5f + 0.5f);
+    }
+    int x0 = std::max(0, (int)std::floor(low.x)), y0 = std::max(0, (int)std::floor(low.y));
+    int x1 = std::min(width - 1, (int)std::floor(high.x)), y1 = std::min(height - 1, (int)std::floor(high.y));
+    // Off screen is for frustum culling to decide.
+    if (x0 > x1 || y0 > y1) {
+        return true;
+    }
+    nearest -= OCCLUSION_DEPTH_BIAS;
+    for (int ty = y0 / OCCLUSION_TILE; ty <= y1 / OCCLUSION_TILE; ty++) {
+        for (int tx = x0 / OCCLUSION_TILE; tx <= x1 / OCCLUSION_TILE; tx++) {
+            size_t tile = (size_t)ty * tiles_x + tx;
+            if (nearest <= tile_min[tile]) {
+                return true;
+            }
+            if (nearest > tile_max[tile]) {
+                continue;
+            }
+            int px0 = std::max(x0, tx * OCCLUSION_TILE), px1 = std::min(x1, tx * OCCLUSION_TILE + OCCLUSION_TILE - 1);
+            int py0 = std::max(y0, ty * OCCLUSION_TILE), py1 = std::min(y1, ty * OCCLUSION_TILE + OCCLUSION_TILE - 1);
+            for (int y = py0; y <= py1; y++) {
+                const float* row = depth.data() + (size_t)y * width;
+                for (int x = px0; x <= px1; x++) {
+                    if (nearest <= row[x]) {
+                        return true;
+                    }
+                }
+            }
+        }
+    }
+    return false;
+}
+
+bool OcclusionBuffer::write_pgm(const std::string& path) const {
+    std::ofstream out(path, std::ofstream::binary | std::ofstream::trunc);
+    if (!out) {
+        std::cout << "ERROR::OCCLUSION::OPEN_FAILED " << path << std::endl;
+        return false;
+    }
+    out << "P5\n" << width << " " << height << "\n255\n";
+    std::vector<unsigned char> row(width);
+    for (int y = height - 1; y >= 0; y--) {
+        for (int x = 0; x < width; x++) {
+            row[x] = (unsigned char)(glm::clamp(depth_at(x, y), 0.0f, 1.0f) * 255.0f);
+        }
+        out.write((const char*)row.data(), width);
+    }
+    return (bool)out;
+}
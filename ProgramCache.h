@@ -0,0 +1,211 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+#include <MeshCache.h>
+#include <MappedFile.h>
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <thread>
+#include <iostream>
+#include <functional>
+#include <filesystem>
+
+// glGetProgramBinary and friends are GL 4.1 (ARB_get_program_binary), the glad loader stops at 4.0.
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+
+typedef void (APIENTRYP PFNGLGETPROGRAMBINARYPROC)(GLuint program, GLsizei bufSize, GLsizei* length,
+    GLenum* binaryFormat, void* binary);
+typedef void (APIENTRYP PFNGLPROGRAMBINARYPROC)(GLuint program, GLenum binaryFormat, const void* binary,
+    GLsizei length);
+typedef void (APIENTRYP PFNGLPROGRAMPARAMETERIPROC)(GLuint program, GLenum pname, GLint value);
+
+const uint32_t PROGRAM_CACHE_VERSION = 1;
+
+struct ProgramCacheStats {
+    size_t hits = 0;
+    size_t misses = 0;
+    size_t rejected = 0;
+};
+
+// Linked program binaries on disk, one file per program named after a hash of its sources, defines
+// and the driver's vendor, renderer and version strings. A driver update changes the key, and a
+// binary the driver still refuses is dropped and rebuilt from source.
+class ProgramCache {
+public:
+    static ProgramCache& instance();
+
+    void set_directory(const std::string& path) { directory = path; }
+    void set_enabled(bool enabled) { this->enabled = enabled; }
+    // Needs a current context; false when the driver has no binary formats or lacks the entry points.
+    bool is_supported();
+
+    uint64_t key(const std::string& vertex, const std::string& fragment, const std::string& defines);
+    // Restores a linked program, false on a miss or when the driver rejects the binary.
+    bool load(unsigned int program, uint64_t key);
+    // Call before glLinkProgram, some drivers only keep a retrievable binary when asked up front.
+    void prepare(unsigned int program);
+    bool save(unsigned int program, uint64_t key);
+    void clear();
+
+    const ProgramCacheStats& stats() const { return counters; }
+    void print_stats() const;
+private:
+    std::string directory = "shader_cache";
+    bool enabled = true;
+    bool loaded = false;
+    bool supported = false;
+    std::string driver;
+    ProgramCacheStats counters;
+    PFNGLGETPROGRAMBINARYPROC get_program_binary = nullptr;
+    PFNGLPROGRAMBINARYPROC program_binary = nullptr;
+    PFNGLPROGRAMPARAMETERIPROC program_parameteri = nullptr;
+
+    ProgramCache() = default;
+    std::string path(uint64_t key) const;
+};
+
+struct ProgramCacheHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t key;
+    uint32_t format;
+    uint32_t length;
+};
+
+namespace program_cache {
+    const char MAGIC[4] = { 'P', 'R', 'G', 'C' };
+}
+
+ProgramCache& ProgramCache::instance() {
+    static ProgramCache cache;
+    return cache;
+}
+
+bool ProgramCache::is_supported() {
+    if (!loaded) {
+        loaded = true;
+        get_program_binary = (PFNGLGETPROGRAMBINARYPROC)glfwGetProcAddress("glGetProgramBinary");
+        program_binary = (PFNGLPROGRAMBINARYPROC)glfwGetProcAddress("glProgramBinary");
+        program_parameteri = (PFNGLPROGRAMPARAMETERIPROC)glfwGetProcAddress("glProgramParameteri");
+        int formats = 0;
+        if (get_program_binary && program_binary && program_parameteri) {
+            glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+        }
+        supported = formats > 0;
+
+        const char* vendor = (const char*)glGetString(GL_VENDOR);
+        const char* renderer = (const char*)glGetString(GL_RENDERER);
+        const char* version = (const char*)glGetString(GL_VERSION);
+        driver = std::string(vendor ? vendor : "") + "|" + (renderer ? renderer : "") + "|" + (version ? version : "");
+    }
+    return enabled && supported;
+}
+
+uint64_t ProgramCache::key(const std::string& vertex, const std::string& fragment, const std::string& defines) {
+    is_supported();
+    uint64_t hash = hash_bytes(driver.data(), driver.size(), PROGRAM_CACHE_VERSION);
+    hash = hash_bytes(defines.data(), defines.size(), hash);
+    hash = hash_bytes(vertex.data(), vertex.size(), hash);
+    return hash_bytes(fragment.data(), fragment.size(), hash);
+}
+
+std::string ProgramCache::path(uint64_t key) const {
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long)key);
+    return directory + "/" + name;
+}
+
+bool ProgramCache::load(unsigned int program, uint64_t key) {
+    if (!is_supported()) {
+        return false;
+    }
+    MappedFile file(path(key));
+    if (!file.is_open() || file.size() < sizeof(ProgramCacheHeader)) {
+        counters.misses++;
+        return false;
+    }
+    ProgramCacheHeader header;
+    std::memcpy(&header, file.data(), sizeof(header));
+    if (std::memcmp(header.magic, program_cache::MAGIC, 4) != 0 || header.version != PROGRAM_CACHE_VERSION ||
+        header.key != key || sizeof(header) + (uint64_t)header.length > file.size()) {
+        counters.misses++;
+        return false;
+    }
+
+    program_binary(program, header.format, file.data() + sizeof(header), (GLsizei)header.length);
+    int success = 0;
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    if (!success) {
+        // The rebuilt program's save() replaces the file.
+        counters.rejected++;
+        return false;
+    }
+    counters.hits++;
+    return true;
+}
+
+void ProgramCache::prepare(unsigned int program) {
+    if (is_supported()) {
+        program_parameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+}
+
+bool ProgramCache::save(unsigned int program, uint64_t key) {
+    if (!is_supported()) {
+        return false;
+    }
+    int length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0) {
+        return false;
+    }
+    std::vector<char> binary(length);
+    ProgramCacheHeader header;
+    std::memcpy(header.magic, program_cache::MAGIC, 4);
+    header.version = PROGRAM_CACHE_VERSION;
+    header.key = key;
+    GLenum format = 0;
+    get_program_binary(program, length, &length, &format, binary.data());
+    header.format = format;
+    header.length = (uint32_t)length;
+
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+    // Same temp-and-rename as the mesh cache, two processes never see a half written binary.
+    std::string file_path = path(key);
+    std::string temp_path = file_path + "." + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+    std::ofstream out(temp_path, std::ofstream::binary | std::ofstream::trunc);
+    if (!out) {
+        return false;
+    }
+    out.write((const char*)&header, sizeof(header));
+    out.write(binary.data(), length);
+    out.close();
+    if (out) {
+        std::filesystem::rename(temp_path, file_path, error);
+    }
+    if (!out || error) {
+        std::remove(temp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+void ProgramCache::clear() {
+    std::error_code error;
+    std::filesystem::remove_all(directory, error);
+}
+
+void ProgramCache::print_stats() const {
+    std::cout << "PROGRAM_CACHE hits " << counters.hits << ", misses " << counters.misses
+        << ", rejected " << counters.rejected << std::endl;
+}
@@ -10,8 +10,20 @@
 #include <Camera.h>
 
 #include <Model.h>
+#include <ThreadPool.h>
+#include <UploadThread.h>
+#include <UniformBlocks.h>
+#include <FrameStats.h>
+#include <GpuProfiler.h>
+#include <Trace.h>
+#include <BenchmarkReport.h>
+#include <BVH.h>
+#include <GpuOcclusion.h>
 
 #include <string>
+#include <cstring>
+#include <memory>
+#include <filesystem>
 #include <iostream>
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
@@ -19,20 +31,75 @@ void glfw_error_callback(int error, const char* description);
 void mouse_callback(GLFWwindow* window, double x_pos, double y_pos);
 void scroll_callback(GLFWwindow* window, double offset_x, double offset_y);
 
+// Seconds per frame spent uploading textures decoded in the background.
+const double TEXTURE_UPLOAD_BUDGET = 0.002;
+// Frames rendered after everything is loaded and compiled, before a benchmark starts measuring.
+const int BENCHMARK_WARMUP_FRAMES = 30;
+// Seconds a benchmark waits for loading to finish before giving up.
+const double BENCHMARK_LOAD_TIMEOUT = 120.0;
+
+// Per-instance data of shaders/lightSource_instanced.vert.
+struct LightInstance {
+    glm::mat4 model;
+    glm::vec3 color;
+};
+
 struct Config {
     int width;
     int height;
     const char* title;
     glm::vec4 color;
+    // Create buffers and textures on a second context instead of the render thread.
+    bool upload_thread;
+    // Pack each model's submeshes into shared buffers, see Model::Model.
+    bool merge_buffers;
+    // Per-frame times are appended here as CSV, nullptr for none.
+    const char* frame_csv;
+    // Frames of CPU trace to write to trace.json from startup on, 0 for none. Needs ENABLE_TRACE.
+    int trace_frames;
+    // No window system: GLFW's null platform with an EGL (surfaceless) or OSMesa context.
+    bool headless;
+    int context_api;
+    // Frames measured along the camera path, 0 for an interactive run.
+    int bench_frames;
+    const char* bench_output;
+    // Report to compare against, nullptr for none.
+    const char* bench_baseline;
+    // Keyframe file for the camera, nullptr for the built-in orbit.
+    const char* camera_path;
+    // Test what passed frustum culling against occluders rasterized on the CPU, see OcclusionBuffer.
+    bool occlusion_culling;
+    // Draw the backpack's submeshes through GPU occlusion queries, see OcclusionQueries.
+    bool gpu_occlusion;
 };
 
 class Renderer {
     GLFWwindow* window;
     Config config;
     Camera cam;
+    std::unique_ptr<ThreadPool> pool;
+    std::unique_ptr<UploadThread> uploader;
     float last_frame = 0, current_frame = 0, delta_time = 0;
+    FrameStats frame_stats;
+    // GPU time of each frame, as measured by the profiler a few frames later.
+    FrameStats gpu_frame_stats;
+    int exit_code = 0;
+    // Headless contexts have no default framebuffer, frames are rendered into this one instead.
+    unsigned int offscreen_fbo = 0, offscreen_color = 0, offscreen_depth = 0;
+
+    bool create_offscreen_target();
 public:
     Renderer(int screen_width, int screen_height, const char* title);
+    void set_frame_csv(const char* path) { config.frame_csv = path; }
+    void set_trace_frames(int frames) { config.trace_frames = frames; }
+    void set_occlusion_culling(bool enabled) { config.occlusion_culling = enabled; }
+    void set_gpu_occlusion(bool enabled) { config.gpu_occlusion = enabled; }
+    // context_api is GLFW_EGL_CONTEXT_API or GLFW_OSMESA_CONTEXT_API.
+    void set_headless(int context_api);
+    void set_benchmark(int frames, const char* output, const char* baseline = nullptr,
+        const char* camera_path = nullptr);
+    // Non-zero after a benchmark that failed or regressed against its baseline.
+    int get_exit_code() const { return exit_code; }
     int setup();
     void render_loop();
     void process_input();
@@ -46,10 +113,48 @@ Renderer::Renderer(int screen_width, int screen_height, const char* title) {
     this->config.height = screen_height;
     this->config.title = title;
     this->config.color = glm::vec4(0.1f, 0.1f, 0.1f, 1.0f);
+    this->config.upload_thread = true;
+    this->config.merge_buffers = true;
+    this->config.frame_csv = nullptr;
+    this->config.trace_frames = 0;
+    this->config.headless = false;
+    this->config.context_api = GLFW_NATIVE_CONTEXT_API;
+    this->config.bench_frames = 0;
+    this->config.bench_output = nullptr;
+    this->config.bench_baseline = nullptr;
+    this->config.camera_path = nullptr;
+    this->config.occlusion_culling = false;
+    this->config.gpu_occlusion = false;
+}
+
+void Renderer::set_headless(int context_api) {
+    config.headless = true;
+    config.context_api = context_api;
+    // Loads finish on the render thread, a second context is one more thing the platform has to share.
+    config.upload_thread = false;
+}
+
+void Renderer::set_benchmark(int frames, const char* output, const char* baseline, const char* camera_path) {
+    config.bench_frames = frames;
+    config.bench_output = output;
+    config.bench_baseline = baseline;
+    config.camera_path = camera_path;
 }
 
 Renderer::~Renderer() {
+    TextureCache::instance().set_decode_pool(nullptr);
+    TextureCache::instance().set_upload_thread(nullptr);
+    // Pool tasks may still submit to the uploader, so the pool goes first; both before the context.
+    pool.reset();
+    uploader.reset();
     if (this->window) {
+        if (offscreen_fbo != 0) {
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+            glDeleteFramebuffers(1, &offscreen_fbo);
+            glDeleteRenderbuffers(1, &offscreen_color);
+            glDeleteRenderbuffers(1, &offscreen_depth);
+        }
+        GpuProfiler::instance().release();
         glfwDestroyWindow(this->window);
     }
     glfwTerminate();
@@ -58,6 +163,9 @@ Renderer::~Renderer() {
 int Renderer::setup() {
     glfwSetErrorCallback(glfw_error_callback);
 
+    if (config.headless) {
+        glfwInitHint(GLFW_PLATFORM, GLFW_PLATFORM_NULL);
+    }
     if (!glfwInit()) {
         std::cout << "ERROR::GLFW::INITIALIZATION_FAILED" << std::endl;
         return -1;
@@ -65,6 +173,10 @@ int Renderer::setup() {
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 4);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    if (config.headless) {
+        glfwWindowHint(GLFW_CONTEXT_CREATION_API, config.context_api);
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    }
 
     this->window = glfwCreateWindow(this->config.width, this->config.height, this->config.title, nullptr, nullptr);
     if (this->window == nullptr) {
@@ -79,6 +191,14 @@ int Renderer::setup() {
         glfwTerminate();
         return -1;
     }
+    if (config.bench_frames > 0) {
+        // Frame times should be the renderer's, not the display's refresh.
+        glfwSwapInterval(0);
+    }
+    if (config.headless && !create_offscreen_target()) {
+        glfwTerminate();
+        return -1;
+    }
 
     GLFWmonitor* monitor = glfwGetPrimaryMonitor();
     
@@ -89,12 +209,59 @@ int Renderer::setup() {
     glfwSetCursorPosCallback(window, mouse_callback);
     glfwSetScrollCallback(window, scroll_callback);
 
-    glEnable(GL_DEPTH_TEST);
+    pool = std::make_unique<ThreadPool>();
+    if (config.upload_thread) {
+        uploader = std::make_unique<UploadThread>(window);
+        if (!uploader->is_running()) {
+            uploader.reset();
+        }
+    }
+
+    GLState::instance().set_depth_test(true);
     //glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
     return 0;
 }
 
+// A surfaceless EGL or OSMesa context has no framebuffer 0 to draw into, without this every draw of a
+// headless benchmark would be discarded and the frame times would measure no rasterization.
+bool Renderer::create_offscreen_target() {
+    glGenRenderbuffers(1, &offscreen_color);
+    glBindRenderbuffer(GL_RENDERBUFFER, offscreen_color);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, config.width, config.height);
+    glGenRenderbuffers(1, &offscreen_depth);
+    glBindRenderbuffer(GL_RENDERBUFFER, offscreen_depth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, config.width, config.height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glGenFramebuffers(1, &offscreen_fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, offscreen_fbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, offscreen_color);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, offscreen_depth);
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+        std::cout << "ERROR::RENDERER::OFFSCREEN_FRAMEBUFFER_INCOMPLETE 0x" << std::hex << status << std::dec
+            << std::endl;
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glDeleteFramebuffers(1, &offscreen_fbo);
+        glDeleteRenderbuffers(1, &offscreen_color);
+        glDeleteRenderbuffers(1, &offscreen_depth);
+        offscreen_fbo = offscreen_color = offscreen_depth = 0;
+        return false;
+    }
+    // Stays bound for the whole run, nothing else binds a framebuffer.
+    return true;
+}
+
 void Renderer::render_loop() {
+    if (config.trace_frames > 0) {
+#ifdef ENABLE_TRACE
+        // Starts before the loads so the import and upload path is in the first frames.
+        trace::begin_capture(config.trace_frames, "trace.json");
+#else
+        std::cout << "ERROR::TRACE::NOT_COMPILED_IN build with ENABLE_TRACE" << std::endl;
+#endif
+    }
+    TRACE_THREAD_NAME("render");
     glm::vec3 point_lights[] = {
         glm::vec3(0.7f,  0.2f,  2.0f), glm::vec3(0.8f, 0.0f, 0.0f),
         glm::vec3(2.3f, -3.3f, -4.0f), glm::vec3(0.0f, 0.8f, 0.0f),
@@ -102,74 +269,189 @@ void Renderer::render_loop() {
         glm::vec3(0.0f,  0.0f, -3.0f), glm::vec3(0.0f, 0.0f, 0.8f)
     };
 
-    Model backpack("models\\backpack\\backpack.obj");
-    Model cube("models\\cube\\cube.obj");
-    Shader shader("shaders\\backpack.vert", "shaders\\backpack.frag");
-    Shader light("shaders\\lightSource.vert", "shaders\\lightSource.frag");
+    TextureCache::instance().set_decode_pool(pool.get());
+    TextureCache::instance().set_upload_thread(uploader.get());
+    std::vector<std::shared_ptr<Model>> models;
+    if (uploader) {
+        models.push_back(Model::load_async("models/backpack/backpack.obj", *pool, *uploader, config.merge_buffers));
+        models.push_back(Model::load_async("models/cube/cube.obj", *pool, *uploader, config.merge_buffers));
+    }
+    else {
+        for (Model& model : Model::load_models({ "models/backpack/backpack.obj",
+            "models/cube/cube.obj" }, *pool, config.merge_buffers)) {
+            models.push_back(std::make_shared<Model>(std::move(model)));
+        }
+        TextureCache::instance().print_stats();
+    }
+    Model& backpack = *models[0];
+    Model& cube = *models[1];
+    double shader_start = glfwGetTime();
+    // Variants are built as meshes ask for them, see Model::draw(ShaderVariants&, uint32_t).
+    ShaderVariants lit("shaders/backpack.vert", "shaders/backpack.frag");
+    Shader light("shaders/lightSource_instanced.vert", "shaders/lightSource.frag");
+    std::cout << "SHADER::STARTUP " << (glfwGetTime() - shader_start) * 1000.0 << " ms" << std::endl;
+    ProgramCache::instance().print_stats();
+
+    // The light cubes never move, their instance data is only uploaded again when culling changes which
+    // of them are visible.
+    LightInstance light_instances[4];
+    for (int i = 0; i < 4; i++) {
+        light_instances[i].model = glm::translate(glm::mat4(1.0f), point_lights[i * 2]);
+        light_instances[i].model = glm::scale(light_instances[i].model, glm::vec3(0.2f));
+        light_instances[i].color = point_lights[i * 2 + 1];
+    }
+    InstanceBuffer light_buffer(sizeof(LightInstance));
+    light_buffer.add_mat4(INSTANCE_ATTRIBUTE_LOCATION, offsetof(LightInstance, model));
+    light_buffer.add_attribute(INSTANCE_ATTRIBUTE_LOCATION + 4, 3, offsetof(LightInstance, color));
+    light_buffer.update(light_instances, 4);
+    AABBList light_bounds;
+    uint8_t light_visible[4] = { 1, 1, 1, 1 };
+    LightInstance visible_lights[4];
+    // Everything drawn, by world bounds, for picking: the backpack and then the four light cubes.
+    BVH scene;
+    const char* scene_names[] = { "backpack", "light 0", "light 1", "light 2", "light 3" };
+    bool pick_held = false;
+
+    // The cube is its own occluder. The backpack needs a low-poly shell next to it, without one it is
+    // only tested against the cubes.
+    OcclusionBuffer occlusion;
+    OccluderMesh backpack_occluder, cube_occluder;
+    if (config.occlusion_culling) {
+        load_occluder("models/cube/cube.obj", cube_occluder);
+        if (std::filesystem::exists("models/backpack/backpack_occluder.obj")) {
+            load_occluder("models/backpack/backpack_occluder.obj", backpack_occluder);
+        }
+        else {
+            std::cout << "OCCLUSION no models/backpack/backpack_occluder.obj, the backpack occludes nothing" << std::endl;
+        }
+    }
 
     glm::mat4 projection = glm::mat4(1.0f);
     glm::vec3 point_light_pos = glm::vec3(0.7f, -1.2f, 4.0f);
     glm::vec3 point_light_color = glm::vec3(0.2f, 0.0f, 0.4f);
    
     glm::vec3 dirlight_color = glm::vec3(1.0f);
-    shader.use();
-    shader.setFloat("material.shininess", 32.0f);
-    shader.setVec3f("dirLight.direction", glm::vec3(0.0f, -1.0f, 0.0f));
-    shader.setVec3f("dirLight.ambient", dirlight_color * 0.2f);
-    shader.setVec3f("dirLight.diffuse", dirlight_color);
-    shader.setVec3f("dirLight.specular", glm::vec3(1.0f));
-
-    shader.setVec3f("pointLights[0].position", point_lights[0]);
-    shader.setVec3f("pointLights[0].ambient", point_lights[1] * 0.2f);
-    shader.setVec3f("pointLights[0].diffuse", point_lights[1]);
-    shader.setVec3f("pointLights[0].specular", point_lights[1]);
-    shader.setFloat("pointLights[0].constant", 1.0f);
-    shader.setFloat("pointLights[0].linear", 0.045f);
-    shader.setFloat("pointLights[0].quadratic", 0.0075f);
-
-    shader.setVec3f("pointLights[1].position", point_lights[2]);
-    shader.setVec3f("pointLights[1].ambient", point_lights[3] * 0.2f);
-    shader.setVec3f("pointLights[1].diffuse", point_lights[3]);
-    shader.setVec3f("pointLights[1].specular", point_lights[3]);
-    shader.setFloat("pointLights[1].constant", 1.0f);
-    shader.setFloat("pointLights[1].linear", 0.045f);
-    shader.setFloat("pointLights[1].quadratic", 0.0075f);
-
-    shader.setVec3f("pointLights[2].position", point_lights[4]);
-    shader.setVec3f("pointLights[2].ambient", point_lights[5] * 0.2f);
-    shader.setVec3f("pointLights[2].diffuse", point_lights[5]);
-    shader.setVec3f("pointLights[2].specular", point_lights[5]);
-    shader.setFloat("pointLights[2].constant", 1.0f);
-    shader.setFloat("pointLights[2].linear", 0.045f);
-    shader.setFloat("pointLights[2].quadratic", 0.0075f);
-
-    shader.setVec3f("pointLights[3].position", point_lights[6]);
-    shader.setVec3f("pointLights[3].ambient", point_lights[7] * 0.2f);
-    shader.setVec3f("pointLights[3].diffuse", point_lights[7]);
-    shader.setVec3f("pointLights[3].specular", point_lights[7]);
-    shader.setFloat("pointLights[3].constant", 1.0f);
-    shader.setFloat("pointLights[3].linear", 0.045f);
-    shader.setFloat("pointLights[3].quadratic", 0.0075f);
-
-    shader.setVec3f("flashLight.ambient", glm::vec3(0.1f, 0.2f, 0.25f) * 0.0f);
-    shader.setVec3f("flashLight.diffuse", glm::vec3(0.1f, 0.2f, 0.25f));
-    shader.setVec3f("flashLight.specular", glm::vec3(0.1f, 0.2f, 0.25f));
-    shader.setFloat("flashLight.cutoff", glm::cos(glm::radians(7.5f)));
-    shader.setFloat("flashLight.outerCutoff", glm::cos(glm::radians(10.5f)));
-    shader.setFloat("flashLight.constant", 1.0f);
-    shader.setFloat("flashLight.linear", 0.07f);
-    shader.setFloat("flashLight.quadratic", 0.017f);
+    lit.setFloat("material.shininess", 32.0f);
+    Material::assign_units(lit);
+
+    UniformBuffer<CameraBlock> camera_block("Camera", CAMERA_BLOCK_BINDING);
+    UniformBuffer<LightsBlock> lights_block("Lights", LIGHTS_BLOCK_BINDING);
+    lit.set_on_create([&](Shader& variant) {
+        camera_block.attach(variant);
+        lights_block.attach(variant);
+    });
+    camera_block.attach(light);
+
+    // Submeshes handed to the occlusion queries each frame: their ids, world boxes and sizes.
+    std::unique_ptr<OcclusionQueries> occlusion_queries;
+    std::vector<uint32_t> query_ids;
+    std::vector<AABB> query_boxes;
+    std::vector<size_t> query_triangles;
+    OcclusionQueryStats query_stats;
+    if (config.gpu_occlusion) {
+        occlusion_queries = std::make_unique<OcclusionQueries>("shaders/occlusion_box.vert", "shaders/occlusion_box.frag");
+        camera_block.attach(occlusion_queries->get_shader());
+    }
+
+    LightsBlock lights = {};
+    lights.dir_light.direction = glm::vec3(0.0f, -1.0f, 0.0f);
+    lights.dir_light.ambient = dirlight_color * 0.2f;
+    lights.dir_light.diffuse = dirlight_color;
+    lights.dir_light.specular = glm::vec3(1.0f);
+
+    for (int i = 0; i < MAX_POINT_LIGHTS; i++) {
+        PointLightBlock& point_light = lights.point_lights[i];
+        point_light.position = point_lights[i * 2];
+        point_light.ambient = point_lights[i * 2 + 1] * 0.2f;
+        point_light.diffuse = point_lights[i * 2 + 1];
+        point_light.specular = point_lights[i * 2 + 1];
+        point_light.constant = 1.0f;
+        point_light.linear = 0.045f;
+        point_light.quadratic = 0.0075f;
+    }
+
+    lights.flash_light.ambient = glm::vec3(0.1f, 0.2f, 0.25f) * 0.0f;
+    lights.flash_light.diffuse = glm::vec3(0.1f, 0.2f, 0.25f);
+    lights.flash_light.specular = glm::vec3(0.1f, 0.2f, 0.25f);
+    lights.flash_light.cut_off = glm::cos(glm::radians(7.5f));
+    lights.flash_light.outer_cut_off = glm::cos(glm::radians(10.5f));
+    lights.flash_light.constant = 1.0f;
+    lights.flash_light.linear = 0.07f;
+    lights.flash_light.quadratic = 0.017f;
+
+    uint32_t scene_features = shader_features::lights(MAX_POINT_LIGHTS);
+
+    if (config.frame_csv) {
+        frame_stats.open_csv(config.frame_csv);
+    }
+
+    // Benchmark runs follow the camera path frame by frame and only start measuring once the models,
+    // textures and shader variants are all in, so two runs render exactly the same frames.
+    bool benchmark = config.bench_frames > 0;
+    CameraPath camera_path = CameraPath::orbit(glm::vec3(0.0f), 6.0f, 1.5f, 8);
+    if (benchmark && config.camera_path && !camera_path.load(config.camera_path)) {
+        camera_path = CameraPath::orbit(glm::vec3(0.0f), 6.0f, 1.5f, 8);
+    }
+    FrameStats bench_stats(benchmark ? config.bench_frames : 1);
+    FrameStats bench_gpu_stats(benchmark ? config.bench_frames : 1);
+    BenchmarkCounters bench_counters;
+    int warmup_left = BENCHMARK_WARMUP_FRAMES;
+    int bench_frame = 0;
+    double bench_start = glfwGetTime();
 
     while (!glfwWindowShouldClose(window)) {
+        // Closes the previous frame of a capture; the first one also holds the startup.
+        trace::end_frame();
+        TRACE_SCOPE("frame");
+        double frame_begin = glfwGetTime();
+        bool measuring = benchmark && warmup_left == 0;
         last_frame = current_frame;
         current_frame = glfwGetTime();
         delta_time = current_frame - last_frame;
-        double fps = 1 / delta_time;
-        std::stringstream ss;
-        ss << "FPS: " << fps;
-        glfwSetWindowTitle(window, ss.str().c_str());
+        double now = glfwGetTime();
+        frame_stats.tick(now);
+        GpuProfiler& gpu_profiler = GpuProfiler::instance();
+        if (gpu_profiler.begin_frame()) {
+            gpu_frame_stats.add(gpu_profiler.frame_ms() / 1000.0);
+            if (measuring) {
+                bench_gpu_stats.add(gpu_profiler.frame_ms() / 1000.0);
+            }
+        }
+        if (!config.headless && frame_stats.should_report(now)) {
+            // Draw and state counts are the previous frame's, they are reset below.
+            FrameSummary gpu = gpu_frame_stats.summary();
+            std::stringstream ss;
+            ss << frame_stats.format() << " | GPU avg " << gpu.average << " ms, p95 " << gpu.p95 << " ("
+                << gpu_profiler.format() << ") | draws " << draw_stats.draw_calls << ", VAO binds " << draw_stats.vao_binds
+                << ", texture binds " << draw_stats.texture_binds << ", skipped " << draw_stats.skipped_draws
+                << " | visible " << draw_stats.visible_meshes << ", culled " << draw_stats.culled_meshes
+                << ", occluded " << draw_stats.occluded_meshes
+                << " | queries " << query_stats.queries << ", conditional " << query_stats.conditional_draws
+                << ", saved draws " << query_stats.saved_draws << ", saved triangles " << query_stats.saved_triangles
+                << " | GL state calls " << GLState::instance().stats().issued << ", redundant "
+                << GLState::instance().stats().skipped;
+            glfwSetWindowTitle(window, ss.str().c_str());
+        }
+        draw_stats = DrawStats();
+        GLState::instance().reset_stats();
+
+        {
+            TRACE_SCOPE("upload");
+            if (uploader) {
+                uploader->poll();
+            }
+            TextureCache::instance().upload_pending(TEXTURE_UPLOAD_BUDGET);
+            lit.poll();
+        }
 
-        process_input();
+        if (benchmark) {
+            float t = measuring && config.bench_frames > 1 ? (float)bench_frame / (config.bench_frames - 1) : 0.0f;
+            CameraKey key = camera_path.sample(t);
+            cam.look_from(key.eye, key.point);
+        }
+        else {
+            process_input();
+        }
 
         glClearColor(config.color.r, config.color.g, config.color.b, config.color.a);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -181,37 +463,180 @@ void Renderer::render_loop() {
         model = glm::scale(model, glm::vec3(1.0f));
         glm::mat3 normal_matrix = glm::transpose(glm::inverse(model));
 
-        shader.use();
-        shader.setMat4f("model", model);
-        shader.setMat4f("view", cam.look_at);
-        shader.setMat4f("projection", projection);
-        shader.setMat3f("normalMatrix", normal_matrix);
-        shader.setVec3f("viewPos", cam.position);
-
-        shader.setVec3f("flashLight.position", cam.position);
-        shader.setVec3f("flashLight.direction", cam.direction);
-
-        backpack.draw(shader);
-
-        light.use();
-        light.setMat4f("view", cam.look_at);
-        light.setMat4f("projection", projection);
-
-        for (int i = 0; i < 4; i++) {
-            glm::mat4 model_light = glm::mat4(1.0f);
-            model_light = glm::translate(model_light, point_lights[i * 2]);
-            model_light = glm::scale(model_light, glm::vec3(0.2f));
+        camera_block.update(CameraBlock::make(cam.look_at, projection, cam.position));
+        lights.flash_light.position = cam.position;
+        lights.flash_light.direction = cam.direction;
+        lights_block.update(lights);
+
+        lit.set_transform(model, normal_matrix);
+
+        {
+            TRACE_SCOPE("cull");
+            glm::mat4 view_projection = projection * cam.look_at;
+            backpack.cull(Frustum::from_matrix(view_projection * model));
+            // The instanced cubes are culled in world space, each by its own transformed box.
+            uint8_t visible[4] = {};
+            if (cube.is_ready()) {
+                light_bounds.clear();
+                for (const LightInstance& instance : light_instances) {
+                    light_bounds.push_back(cube.get_bounds().transformed(instance.model));
+                }
+                size_t visible_count = frustum::cull(cam.frustum(projection), light_bounds, visible);
+                draw_stats.visible_meshes += (unsigned int)visible_count;
+                draw_stats.culled_meshes += (unsigned int)(4 - visible_count);
+            }
+            if (config.occlusion_culling) {
+                TRACE_SCOPE("occlusion");
+                occlusion.clear();
+                if (!backpack_occluder.indices.empty()) {
+                    occlusion.add_occluder(backpack_occluder, view_projection * model);
+                }
+                for (int i = 0; i < 4; i++) {
+                    if (visible[i] && !cube_occluder.indices.empty()) {
+                        occlusion.add_occluder(cube_occluder, view_projection * light_instances[i].model);
+                    }
+                }
+                occlusion.render(pool.get());
+                backpack.cull_occluded(occlusion, view_projection * model);
+                for (int i = 0; i < 4; i++) {
+                    if (visible[i] && !occlusion.is_visible(light_bounds.get(i), view_projection)) {
+                        visible[i] = 0;
+                        draw_stats.occluded_meshes++;
+                    }
+                }
+            }
+            if (cube.is_ready() && std::memcmp(visible, light_visible, sizeof(visible)) != 0) {
+                std::memcpy(light_visible, visible, sizeof(visible));
+                size_t count = 0;
+                for (int i = 0; i < 4; i++) {
+                    if (visible[i]) {
+                        visible_lights[count++] = light_instances[i];
+                    }
+                }
+                light_buffer.update(visible_lights, count);
+            }
+        }
 
+        if (scene.empty() && backpack.is_ready() && cube.is_ready()) {
+            std::vector<AABB> bounds = { backpack.get_bounds().transformed(model) };
+            for (const LightInstance& instance : light_instances) {
+                bounds.push_back(cube.get_bounds().transformed(instance.model));
+            }
+            scene.build(bounds);
+        }
+        // Left click picks whatever is under the centre of the screen, where the camera looks.
+        bool pick = !benchmark && glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS;
+        if (pick && !pick_held && !scene.empty()) {
+            glm::vec3 origin, ray;
+            cam.pick_ray(0.0f, 0.0f, projection, origin, ray);
+            float distance = 100.0f;
+            int hit = scene.raycast(origin, ray, distance);
+            if (hit >= 0) {
+                std::cout << "PICK " << scene_names[hit] << " at " << distance << std::endl;
+            }
+            else {
+                std::cout << "PICK nothing" << std::endl;
+            }
+        }
+        pick_held = pick;
+
+        {
+            TRACE_SCOPE("models");
+            GpuScope scope("models");
+            if (occlusion_queries && backpack.is_ready()) {
+                query_ids.clear();
+                query_boxes.clear();
+                query_triangles.clear();
+                for (size_t i = 0; i < backpack.mesh_count(); i++) {
+                    if (backpack.is_mesh_visible(i)) {
+                        query_ids.push_back((uint32_t)i);
+                        query_boxes.push_back(backpack.get_mesh_bounds().get(i).transformed(model));
+                        query_triangles.push_back(backpack.mesh_triangles(i));
+                    }
+                }
+                occlusion_queries->render(query_ids.size(), query_ids.data(), query_boxes.data(),
+                    query_triangles.data(), cam.position, projection, [&](size_t k) {
+                        backpack.draw_mesh(query_ids[k], lit, scene_features);
+                    });
+                query_stats = occlusion_queries->stats();
+            }
+            else {
+                backpack.draw(lit, scene_features);
+            }
+        }
+        {
+            TRACE_SCOPE("lights");
+            GpuScope scope("lights");
             light.use();
-            light.setMat4f("model", model_light);
-            light.setVec3f("lightColor", point_lights[i * 2 + 1]);
-            cube.draw(light);
+            cube.draw_instanced(light, light_buffer);
         }
 
-        glfwSwapBuffers(window);
-        glfwPollEvents();
+        gpu_profiler.end_frame();
+        {
+            TRACE_SCOPE("swap");
+            glfwSwapBuffers(window);
+            glfwPollEvents();
+        }
+
+        if (benchmark) {
+            if (measuring) {
+                // Waits for the GPU so a frame's time covers its rendering, not just its submission.
+                glFinish();
+                bench_stats.add(glfwGetTime() - frame_begin);
+                bench_counters.draw_calls += draw_stats.draw_calls;
+                bench_counters.vao_binds += draw_stats.vao_binds;
+                bench_counters.texture_binds += draw_stats.texture_binds;
+                bench_counters.triangles += draw_stats.triangles;
+                bench_counters.visible_meshes += draw_stats.visible_meshes;
+                bench_counters.culled_meshes += draw_stats.culled_meshes;
+                bench_counters.occluded_meshes += draw_stats.occluded_meshes;
+                bench_counters.saved_draws += query_stats.saved_draws;
+                bench_counters.saved_triangles += query_stats.saved_triangles;
+                bench_counters.state_calls += GLState::instance().stats().issued;
+                bench_counters.redundant_state_calls += GLState::instance().stats().skipped;
+                if (++bench_frame == config.bench_frames) {
+                    break;
+                }
+            }
+            else if (backpack.is_ready() && cube.is_ready() && lit.pending() == 0 &&
+                TextureCache::instance().stats().pending == 0) {
+                warmup_left--;
+            }
+            else if (glfwGetTime() - bench_start > BENCHMARK_LOAD_TIMEOUT) {
+                break;
+            }
+        }
     }
-    glfwTerminate();
+    if (benchmark) {
+        BenchmarkReport report;
+        report.context_api = !config.headless ? "native" :
+            config.context_api == GLFW_OSMESA_CONTEXT_API ? "osmesa" : "egl";
+        const char* gl_renderer = (const char*)glGetString(GL_RENDERER);
+        report.gl_renderer = gl_renderer ? gl_renderer : "";
+        report.width = config.width;
+        report.height = config.height;
+        report.warmup_frames = BENCHMARK_WARMUP_FRAMES;
+        report.cpu = bench_stats.summary();
+        report.gpu = bench_gpu_stats.summary();
+        report.counters = bench_counters;
+        report.frame_times = bench_stats.samples();
+        std::string output = config.bench_output ? config.bench_output : "bench_headless.json";
+        if (bench_frame < config.bench_frames || !write_benchmark_json(output, report)) {
+            std::cout << "ERROR::BENCHMARK::INCOMPLETE " << bench_frame << " of " << config.bench_frames
+                << " frames" << std::endl;
+            exit_code = 1;
+        }
+        else {
+            std::cout << "BENCHMARK wrote " << output << ": " << bench_stats.format() << std::endl;
+            if (config.bench_baseline && compare_benchmark_json(config.bench_baseline, output) != 0) {
+                exit_code = 1;
+            }
+        }
+    }
+    frame_stats.print_summary();
+    frame_stats.close_csv();
+    std::cout << "GPU_FRAME_STATS " << gpu_frame_stats.format() << std::endl;
+    GpuProfiler::instance().print();
 }
 
 void Renderer::process_input() {
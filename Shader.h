@@ -3,28 +3,83 @@
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 
+#include <ProgramCache.h>
+#include <GLState.h>
+
 #include <string>
+#include <unordered_map>
 #include <sstream>
 #include <fstream>
 #include <iostream>
 
+// Location of a uniform resolved once, typed so Shader::set picks the matching glUniform call.
+template<typename T>
+struct Uniform {
+    int location = -1;
+};
+
+enum class ShaderStatus {
+    COMPILING,
+    READY,
+    FAILED
+};
+
+struct ShaderSource {
+    std::string vertex;
+    std::string fragment;
+};
+
+bool read_shader_source(const std::string& vertex_path, const std::string& fragment_path, ShaderSource& source);
+// Inserts defines right after the #version line, which has to stay first.
+std::string inject_defines(const std::string& code, const std::string& defines);
+
 class Shader {
 public:
-    unsigned int ID;
+    unsigned int ID = 0;
 
     Shader(const std::string& vertex_path, const std::string& fragment_path);
+    // Builds the sources with defines ("#define NAME value" lines) injected into both stages. Without
+    // wait the compile is only submitted; poll() until it is ready, the program can't be used before.
+    Shader(const ShaderSource& source, const std::string& defines, bool wait = true);
     ~Shader();
     void use();
 
+    ShaderStatus get_status() const { return status; }
+    bool is_ready() const { return status == ShaderStatus::READY; }
+    // Never blocks where GL_KHR_parallel_shader_compile is supported. True once the program is usable.
+    bool poll();
+    // Blocks until the compile has finished.
+    void finish();
+
+    // -1 when the program has no active uniform of that name. Array elements are listed as "name[i]",
+    // the first also as "name".
+    int uniform_location(const std::string& name) const;
+    template<typename T>
+    Uniform<T> uniform(const std::string& name) const { return Uniform<T>{ uniform_location(name) }; }
+
+    // The program must be in use, glProgramUniform needs GL 4.1.
+    void set(Uniform<glm::mat4> uniform, const glm::mat4& mat);
+    void set(Uniform<glm::mat3> uniform, const glm::mat3& mat);
+    void set(Uniform<glm::vec3> uniform, const glm::vec3& vec);
+    void set(Uniform<int> uniform, int value);
+    void set(Uniform<float> uniform, float value);
+
     void setMat4f(const std::string& name, glm::mat4 mat);
     void setMat3f(const std::string& name, glm::mat3 mat);
     void setVec3f(const std::string& name, glm::vec3 vec);
     void setInt(const std::string& name, int value);
     void setFloat(const std::string& name, float value);
+private:
+    std::unordered_map<std::string, int> uniforms;
+    ShaderStatus status = ShaderStatus::FAILED;
+    unsigned int vertex = 0, fragment = 0;
+    uint64_t cache_key = 0;
+
+    void submit(const std::string& vertex_code, const std::string& fragment_code, const std::string& defines);
+    void reflect_uniforms();
 };
 
-Shader::Shader(const std::string& vertex_path, const std::string& fragment_path) {
-    std::string vertex_code, fragment_code;
+bool read_shader_source(const std::string& vertex_path, const std::string& fragment_path, ShaderSource& source) {
     std::ifstream v_file, f_file;
 
     v_file.exceptions(std::ifstream::badbit | std::ifstream::failbit);
@@ -41,80 +96,247 @@ Shader::Shader(const std::string& vertex_path, const std::string& fragment_path)
         v_file.close();
         f_file.close();
 
-        vertex_code = v_stream.str();
-        fragment_code = f_stream.str();
+        source.vertex = v_stream.str();
+        source.fragment = f_stream.str();
     }
     catch (std::ifstream::failure& e) {
         std::cout << "ERROR::SHADER::FAILED_TO_READ_FILE " << e.what() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+std::string inject_defines(const std::string& code, const std::string& defines) {
+    if (defines.empty()) {
+        return code;
+    }
+    size_t version = code.find("#version");
+    if (version == std::string::npos) {
+        return defines + code;
+    }
+    size_t line_end = code.find('\n', version);
+    if (line_end == std::string::npos) {
+        return code + "\n" + defines;
+    }
+    return code.substr(0, line_end + 1) + defines + code.substr(line_end + 1);
+}
+
+Shader::Shader(const std::string& vertex_path, const std::string& fragment_path) {
+    ShaderSource source;
+    if (!read_shader_source(vertex_path, fragment_path, source)) {
         glfwTerminate();
         return;
     }
 
+    submit(source.vertex, source.fragment, "");
+    finish();
+}
+
+Shader::Shader(const ShaderSource& source, const std::string& defines, bool wait) {
+    submit(inject_defines(source.vertex, defines), inject_defines(source.fragment, defines), defines);
+    if (wait) {
+        finish();
+    }
+}
+
+namespace parallel_compile {
+    // GL_KHR_parallel_shader_compile / GL_ARB_parallel_shader_compile, neither is in the glad loader.
+    const GLenum COMPLETION_STATUS = 0x91B1;
+    typedef void (APIENTRYP PFNGLMAXSHADERCOMPILERTHREADSPROC)(GLuint count);
+
+    bool checked = false;
+    bool available = false;
+
+    // Needs a current context. Lets the driver pick its compiler thread count the first time.
+    bool supported() {
+        if (!checked) {
+            checked = true;
+            const char* names[][2] = {
+                { "GL_KHR_parallel_shader_compile", "glMaxShaderCompilerThreadsKHR" },
+                { "GL_ARB_parallel_shader_compile", "glMaxShaderCompilerThreadsARB" },
+            };
+            for (const auto& name : names) {
+                if (glfwExtensionSupported(name[0])) {
+                    PFNGLMAXSHADERCOMPILERTHREADSPROC max_threads =
+                        (PFNGLMAXSHADERCOMPILERTHREADSPROC)glfwGetProcAddress(name[1]);
+                    if (max_threads) {
+                        max_threads(0xFFFFFFFF);
+                    }
+                    available = true;
+                    break;
+                }
+            }
+        }
+        return available;
+    }
+}
+
+// Restores the program from the binary cache when it can, otherwise submits compile and link without
+// waiting on the driver. finish() collects the result and stores it for the next run.
+void Shader::submit(const std::string& vertex_code, const std::string& fragment_code, const std::string& defines) {
+    ProgramCache& cache = ProgramCache::instance();
+    cache_key = cache.key(vertex_code, fragment_code, defines);
+    ID = glCreateProgram();
+    if (cache.load(ID, cache_key)) {
+        reflect_uniforms();
+        status = ShaderStatus::READY;
+        return;
+    }
 
     const char* v_code = vertex_code.c_str();
     const char* f_code = fragment_code.c_str();
 
-    int success;
-    char info_log[512];
-
-    unsigned int vertex, fragment;
     vertex = glCreateShader(GL_VERTEX_SHADER);
     glShaderSource(vertex, 1, &v_code, NULL);
     glCompileShader(vertex);
+
+    fragment = glCreateShader(GL_FRAGMENT_SHADER);
+    glShaderSource(fragment, 1, &f_code, NULL);
+    glCompileShader(fragment);
+
+    glAttachShader(ID, vertex);
+    glAttachShader(ID, fragment);
+    cache.prepare(ID);
+    glLinkProgram(ID);
+    status = ShaderStatus::COMPILING;
+}
+
+bool Shader::poll() {
+    if (status != ShaderStatus::COMPILING) {
+        return status == ShaderStatus::READY;
+    }
+    if (parallel_compile::supported()) {
+        int done = 0;
+        glGetProgramiv(ID, parallel_compile::COMPLETION_STATUS, &done);
+        if (!done) {
+            return false;
+        }
+    }
+    // Without the extension the status queries below block until the driver is done.
+    finish();
+    return status == ShaderStatus::READY;
+}
+
+void Shader::finish() {
+    if (status != ShaderStatus::COMPILING) {
+        return;
+    }
+    int success;
+    char info_log[512];
+
     glGetShaderiv(vertex, GL_COMPILE_STATUS, &success);
     if (!success) {
         glGetShaderInfoLog(vertex, 512, NULL, info_log);
         std::cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n" << info_log << std::endl;
     }
 
-    fragment = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fragment, 1, &f_code, NULL);
-    glCompileShader(fragment);
     glGetShaderiv(fragment, GL_COMPILE_STATUS, &success);
     if (!success) {
         glGetShaderInfoLog(fragment, 512, NULL, info_log);
         std::cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n" << info_log << std::endl;
     }
 
-    ID = glCreateProgram();
-    glAttachShader(ID, vertex);
-    glAttachShader(ID, fragment);
-    glLinkProgram(ID);
-
     glGetProgramiv(ID, GL_LINK_STATUS, &success);
     if (!success) {
         glGetProgramInfoLog(ID, 512, NULL, info_log);
         std::cout << "ERROR::SHADER::LINKING_FAILED\n" << info_log << std::endl;
+        status = ShaderStatus::FAILED;
+    }
+    else {
+        ProgramCache::instance().save(ID, cache_key);
+        status = ShaderStatus::READY;
     }
 
     glDeleteShader(vertex);
     glDeleteShader(fragment);
+    vertex = fragment = 0;
+
+    reflect_uniforms();
+}
+
+void Shader::reflect_uniforms() {
+    int count = 0, max_length = 0;
+    glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+    glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_length);
+    std::string name(max_length, '\0');
+    for (int i = 0; i < count; i++) {
+        int length = 0, size = 0;
+        GLenum type;
+        glGetActiveUniform(ID, i, max_length, &length, &size, &type, &name[0]);
+        std::string uniform = name.substr(0, length);
+        // Uniforms in blocks have no location.
+        int location = glGetUniformLocation(ID, uniform.c_str());
+        if (location < 0) {
+            continue;
+        }
+        uniforms[uniform] = location;
+
+        size_t bracket = uniform.rfind("[0]");
+        if (bracket == std::string::npos || bracket + 3 != uniform.size()) {
+            continue;
+        }
+        std::string base = uniform.substr(0, bracket);
+        uniforms[base] = location;
+        for (int element = 1; element < size; element++) {
+            std::string element_name = base + "[" + std::to_string(element) + "]";
+            uniforms[element_name] = glGetUniformLocation(ID, element_name.c_str());
+        }
+    }
+}
+
+int Shader::uniform_location(const std::string& name) const {
+    auto found = uniforms.find(name);
+    return found == uniforms.end() ? -1 : found->second;
+}
+
+void Shader::set(Uniform<glm::mat4> uniform, const glm::mat4& mat) {
+    glUniformMatrix4fv(uniform.location, 1, GL_FALSE, glm::value_ptr(mat));
+}
+
+void Shader::set(Uniform<glm::mat3> uniform, const glm::mat3& mat) {
+    glUniformMatrix3fv(uniform.location, 1, GL_FALSE, glm::value_ptr(mat));
+}
+
+void Shader::set(Uniform<glm::vec3> uniform, const glm::vec3& vec) {
+    glUniform3fv(uniform.location, 1, glm::value_ptr(vec));
+}
+
+void Shader::set(Uniform<int> uniform, int value) {
+    glUniform1i(uniform.location, value);
+}
+
+void Shader::set(Uniform<float> uniform, float value) {
+    glUniform1f(uniform.location, value);
 }
 
 Shader::~Shader() {
-    glDeleteProgram(ID);
+    if (vertex != 0) {
+        glDeleteShader(vertex);
+        glDeleteShader(fragment);
+    }
+    GLState::instance().delete_program(ID);
 }
 
 void Shader::use() {
-    glUseProgram(ID);
+    GLState::instance().use_program(ID);
 }
 
 void Shader::setMat4f(const std::string& name, glm::mat4 mat) {
-    glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, glm::value_ptr(mat));
+    glUniformMatrix4fv(uniform_location(name), 1, GL_FALSE, glm::value_ptr(mat));
 }
 
 void Shader::setInt(const std::string& name, int value) {
-    glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+    glUniform1i(uniform_location(name), value);
 }
 
 void Shader::setMat3f(const std::string& name, glm::mat3 mat) {
-    glUniformMatrix3fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, glm::value_ptr(mat));
+    glUniformMatrix3fv(uniform_location(name), 1, GL_FALSE, glm::value_ptr(mat));
 }
 
 void Shader::setVec3f(const std::string& name, glm::vec3 vec) {
-    glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, glm::value_ptr(vec));
+    glUniform3fv(uniform_location(name), 1, glm::value_ptr(vec));
 }
 
 void Shader::setFloat(const std::string& name, float value) {
-    glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+    glUniform1f(uniform_location(name), value);
 }
\ No newline at end of file
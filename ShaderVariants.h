@@ -0,0 +1,287 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#include <glm/glm.hpp>
+
+#include <Shader.h>
+
+#include <string>
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+
+// Feature bitmask of the lit shaders (backpack.vert/frag): how many samplers of each material texture
+// type are read and how many point lights are looped over, two or three bits each, and whether the
+// transform comes from per-instance attributes.
+namespace shader_features {
+    const int MAX_MATERIAL_TEXTURES = 3;
+    const int MAX_POINT_LIGHTS = 4;
+
+    const uint32_t DIFFUSE_SHIFT = 0;
+    const uint32_t SPECULAR_SHIFT = 2;
+    const uint32_t EMISSION_SHIFT = 4;
+    const uint32_t POINT_LIGHT_SHIFT = 6;
+    // Model and normal matrix per instance (LitInstance) instead of the model/normalMatrix uniforms.
+    const uint32_t INSTANCED = 1u << 9;
+
+    uint32_t clamp_count(int count, int max) {
+        return (uint32_t)(count < 0 ? 0 : count > max ? max : count);
+    }
+
+    uint32_t material(int diffuse, int specular, int emission) {
+        return clamp_count(diffuse, MAX_MATERIAL_TEXTURES) << DIFFUSE_SHIFT |
+            clamp_count(specular, MAX_MATERIAL_TEXTURES) << SPECULAR_SHIFT |
+            clamp_count(emission, MAX_MATERIAL_TEXTURES) << EMISSION_SHIFT;
+    }
+
+    uint32_t lights(int point_lights) {
+        return clamp_count(point_lights, MAX_POINT_LIGHTS) << POINT_LIGHT_SHIFT;
+    }
+
+    std::string defines(uint32_t features) {
+        return "#define NUM_DIFFUSE " + std::to_string(features >> DIFFUSE_SHIFT & 3) + "\n" +
+            "#define NUM_SPECULAR " + std::to_string(features >> SPECULAR_SHIFT & 3) + "\n" +
+            "#define NUM_EMISSION " + std::to_string(features >> EMISSION_SHIFT & 3) + "\n" +
+            "#define NUM_POINT_LIGHT " + std::to_string(features >> POINT_LIGHT_SHIFT & 7) + "\n" +
+            (features & INSTANCED ? "#define INSTANCED\n" : "");
+    }
+}
+
+// Permutations of one vertex/fragment pair, keyed by feature bitmask. Each variant is compiled the
+// first time it is asked for (or restored from the program cache) and kept for the lifetime of the set.
+//
+// Uniforms written through the set go to every variant built so far and are replayed on the ones built
+// later, so callers don't have to know which variants exist. The per-draw transform is the exception:
+// set_transform() only stores it, and get()/try_get() write it to the variant they hand out through
+// handles resolved when the variant was built.
+//
+// get() blocks until the variant is linked. try_get() and prepare() only submit the compile, poll()
+// then picks up whatever the driver has finished, so a frame never waits on the GLSL compiler.
+class ShaderVariants {
+public:
+    ShaderVariants(const std::string& vertex_path, const std::string& fragment_path,
+        std::function<std::string(uint32_t)> defines = shader_features::defines);
+    ShaderVariants(const ShaderVariants&) = delete;
+    ShaderVariants& operator=(const ShaderVariants&) = delete;
+
+    Shader& get(uint32_t features);
+    // nullptr until the variant is ready; the first call submits its compile.
+    Shader* try_get(uint32_t features);
+    // Submits every variant up front so the driver can compile them in parallel.
+    void prepare(const std::vector<uint32_t>& features);
+    // Finishes compiled variants. With GL_KHR_parallel_shader_compile this never blocks, without it at
+    // most one variant is waited on per call. Returns how many became ready.
+    int poll();
+    size_t size() const { return variants.size(); }
+    size_t pending() const;
+    // Runs on every variant when it is created, e.g. to attach uniform blocks.
+    void set_on_create(std::function<void(Shader&)> callback);
+
+    // The "model" and "normalMatrix" uniforms of the next draws.
+    void set_transform(const glm::mat4& model, const glm::mat3& normal_matrix);
+
+    void setMat4f(const std::string& name, const glm::mat4& mat);
+    void setMat3f(const std::string& name, const glm::mat3& mat);
+    void setInt(const std::string& name, int value);
+    void setFloat(const std::string& name, float value);
+private:
+    ShaderSource source;
+    std::function<std::string(uint32_t)> defines;
+    std::function<void(Shader&)> on_create;
+    struct Variant {
+        std::unique_ptr<Shader> shader;
+        // on_create has run and the stored uniforms are applied.
+        bool initialized = false;
+        Uniform<glm::mat4> model;
+        Uniform<glm::mat3> normal_matrix;
+        // transform_serial when the transform was last written to this variant, 0 for never.
+        uint64_t transform_serial = 0;
+    };
+
+    std::unordered_map<uint32_t, Variant> variants;
+    std::unordered_map<std::string, glm::mat4> mat4_values;
+    std::unordered_map<std::string, glm::mat3> mat3_values;
+    std::unordered_map<std::string, int> int_values;
+    std::unordered_map<std::string, float> float_values;
+    glm::mat4 model = glm::mat4(1.0f);
+    glm::mat3 normal_matrix = glm::mat3(1.0f);
+    uint64_t transform_serial = 1;
+
+    Variant& submit(uint32_t features, bool wait);
+    void initialize(Variant& variant);
+    void apply_transform(Variant& variant);
+    void apply(Shader& shader) const;
+};
+
+ShaderVariants::ShaderVariants(const std::string& vertex_path, const std::string& fragment_path,
+    std::function<std::string(uint32_t)> defines) {
+    this->defines = defines;
+    read_shader_source(vertex_path, fragment_path, source);
+}
+
+ShaderVariants::Variant& ShaderVariants::submit(uint32_t features, bool wait) {
+    auto found = variants.find(features);
+    if (found != variants.end()) {
+        return found->second;
+    }
+    Variant& variant = variants[features];
+    variant.shader = std::make_unique<Shader>(source, defines(features), wait);
+    return variant;
+}
+
+Shader& ShaderVariants::get(uint32_t features) {
+    Variant& variant = submit(features, true);
+    variant.shader->finish();
+    initialize(variant);
+    apply_transform(variant);
+    return *variant.shader;
+}
+
+Shader* ShaderVariants::try_get(uint32_t features) {
+    Variant& variant = submit(features, false);
+    // Program cache hits are ready straight away.
+    initialize(variant);
+    if (!variant.initialized || !variant.shader->is_ready()) {
+        return nullptr;
+    }
+    apply_transform(variant);
+    return variant.shader.get();
+}
+
+void ShaderVariants::apply_transform(Variant& variant) {
+    if (!variant.shader->is_ready() || variant.transform_serial == transform_serial) {
+        return;
+    }
+    variant.shader->use();
+    variant.shader->set(variant.model, model);
+    variant.shader->set(variant.normal_matrix, normal_matrix);
+    variant.transform_serial = transform_serial;
+}
+
+void ShaderVariants::set_transform(const glm::mat4& model, const glm::mat3& normal_matrix) {
+    this->model = model;
+    this->normal_matrix = normal_matrix;
+    transform_serial++;
+}
+
+void ShaderVariants::prepare(const std::vector<uint32_t>& features) {
+    for (uint32_t feature : features) {
+        submit(feature, false);
+    }
+}
+
+int ShaderVariants::poll() {
+    int ready = 0;
+    bool waited = false;
+    for (auto& entry : variants) {
+        Variant& variant = entry.second;
+        if (variant.initialized) {
+            continue;
+        }
+        if (variant.shader->get_status() == ShaderStatus::COMPILING) {
+            if (!parallel_compile::supported() && waited) {
+                continue;
+            }
+            waited = true;
+            if (!variant.shader->poll()) {
+                continue;
+            }
+        }
+        initialize(variant);
+        ready++;
+    }
+    return ready;
+}
+
+size_t ShaderVariants::pending() const {
+    size_t count = 0;
+    for (const auto& entry : variants) {
+        count += entry.second.initialized ? 0 : 1;
+    }
+    return count;
+}
+
+void ShaderVariants::initialize(Variant& variant) {
+    // Failed variants count as initialized too, they are never retried.
+    if (variant.initialized || variant.shader->get_status() == ShaderStatus::COMPILING) {
+        return;
+    }
+    variant.initialized = true;
+    if (!variant.shader->is_ready()) {
+        return;
+    }
+    variant.model = variant.shader->uniform<glm::mat4>("model");
+    variant.normal_matrix = variant.shader->uniform<glm::mat3>("normalMatrix");
+    if (on_create) {
+        on_create(*variant.shader);
+    }
+    apply(*variant.shader);
+}
+
+void ShaderVariants::set_on_create(std::function<void(Shader&)> callback) {
+    on_create = callback;
+    for (auto& variant : variants) {
+        if (variant.second.initialized && variant.second.shader->is_ready()) {
+            on_create(*variant.second.shader);
+        }
+    }
+}
+
+void ShaderVariants::apply(Shader& shader) const {
+    shader.use();
+    for (const auto& value : mat4_values) {
+        shader.setMat4f(value.first, value.second);
+    }
+    for (const auto& value : mat3_values) {
+        shader.setMat3f(value.first, value.second);
+    }
+    for (const auto& value : int_values) {
+        shader.setInt(value.first, value.second);
+    }
+    for (const auto& value : float_values) {
+        shader.setFloat(value.first, value.second);
+    }
+}
+
+void ShaderVariants::setMat4f(const std::string& name, const glm::mat4& mat) {
+    mat4_values[name] = mat;
+    for (auto& variant : variants) {
+        if (variant.second.initialized && variant.second.shader->is_ready()) {
+            variant.second.shader->use();
+            variant.second.shader->setMat4f(name, mat);
+        }
+    }
+}
+
+void ShaderVariants::setMat3f(const std::string& name, const glm::mat3& mat) {
+    mat3_values[name] = mat;
+    for (auto& variant : variants) {
+        if (variant.second.initialized && variant.second.shader->is_ready()) {
+            variant.second.shader->use();
+            variant.second.shader->setMat3f(name, mat);
+        }
+    }
+}
+
+void ShaderVariants::setInt(const std::string& name, int value) {
+    int_values[name] = value;
+    for (auto& variant : variants) {
+        if (variant.second.initialized && variant.second.shader->is_ready()) {
+            variant.second.shader->use();
+            variant.second.shader->setInt(name, value);
+        }
+    }
+}
+
+void ShaderVariants::setFloat(const std::string& name, float value) {
+    float_values[name] = value;
+    for (auto& variant : variants) {
+        if (variant.second.initialized && variant.second.shader->is_ready()) {
+            variant.second.shader->use();
+            variant.second.shader->setFloat(name, value);
+        }
+    }
+}
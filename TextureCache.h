@@ -0,0 +1,388 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#include <stb_image.h>
+
+#include <MeshCache.h>
+#include <ThreadPool.h>
+#include <MpscQueue.h>
+#include <UploadThread.h>
+#include <GLState.h>
+#include <Trace.h>
+
+#include <string>
+#include <cstdlib>
+#include <memory>
+#include <cctype>
+#include <iostream>
+#include <filesystem>
+#include <unordered_map>
+
+struct DecodedImage {
+    unsigned char* pixels = nullptr;
+    int width = 0;
+    int height = 0;
+    int channels = 0;
+};
+
+void load_texture(const std::string& texture_path, unsigned int* id, size_t* bytes = nullptr);
+size_t load_from_image(const std::string& texture_path);
+// stb_image decode, safe on any thread. Images are expanded to RGB or RGBA and flipped vertically, by
+// the flag TextureCache sets once on the GL thread before any decode runs.
+bool decode_image(const std::string& texture_path, DecodedImage& image);
+// Uploads to the texture bound to GL_TEXTURE_2D and frees the pixels, returns the bytes uploaded.
+size_t upload_image(DecodedImage& image);
+// Creates a new texture filled through a pixel unpack buffer and frees the pixels, for the upload thread.
+unsigned int upload_image_streamed(DecodedImage& image);
+
+// GL texture shared by every Mesh that references the same image, deleted with the last handle.
+struct TextureResource {
+    unsigned int id = 0;
+    size_t bytes = 0;
+    std::string key;
+
+    ~TextureResource();
+};
+
+typedef std::shared_ptr<TextureResource> TextureHandle;
+
+struct TextureCacheStats {
+    size_t hits = 0;
+    size_t misses = 0;
+    size_t bytes_uploaded = 0;
+    size_t pending = 0;
+};
+
+// Process wide texture cache keyed by normalized absolute path, and optionally by file content so
+// copies of one image under different names are uploaded once. Only used from the GL thread.
+//
+// With a decode pool set, get() returns at once with a 1x1 placeholder in the texture and queues
+// the decode on the pool. upload_pending() then swaps in the real image under the same texture id.
+// With an upload thread as well, decoded images are uploaded into a new texture on that thread and
+// TextureResource::id is switched over once its fence has signalled, so draws must read the id
+// through the handle.
+class TextureCache {
+public:
+    static TextureCache& instance();
+
+    TextureHandle get(const std::string& path);
+    void set_content_hashing(bool enabled) { content_hashing = enabled; }
+    void set_decode_pool(ThreadPool* pool) { decode_pool = pool; }
+    void set_upload_thread(UploadThread* thread) { upload_thread = thread; }
+    // Uploads decoded images until budget_seconds have passed, returns how many were uploaded.
+    int upload_pending(double budget_seconds);
+    const TextureCacheStats& stats() const { return counters; }
+    // Also forgets the entries of textures that have been released.
+    size_t resident_bytes();
+    void print_stats();
+private:
+    struct DecodeResult {
+        std::weak_ptr<TextureResource> texture;
+        DecodedImage image;
+    };
+
+    std::unordered_map<std::string, std::weak_ptr<TextureResource>> by_path;
+    std::unordered_map<uint64_t, std::weak_ptr<TextureResource>> by_content;
+    TextureCacheStats counters;
+    bool content_hashing = false;
+    ThreadPool* decode_pool = nullptr;
+    UploadThread* upload_thread = nullptr;
+    MpscQueue<DecodeResult> decoded;
+    // Size of by_path after the last sweep; get() sweeps again once it has doubled.
+    size_t swept_size = 0;
+
+    TextureCache();
+    ~TextureCache();
+    static std::string normalize(const std::string& path);
+    void load_async(const TextureHandle& handle);
+    void finish_streamed(const std::weak_ptr<TextureResource>& texture, unsigned int id, size_t bytes);
+};
+
+TextureResource::~TextureResource() {
+    // Handles that outlive the context have nothing left to delete.
+    if (id != 0 && glfwGetCurrentContext() != nullptr) {
+        GLState::instance().delete_texture(id);
+    }
+}
+
+TextureCache::TextureCache() {
+    // stb_image keeps this flag in a global, set here before any decode worker reads it.
+    stbi_set_flip_vertically_on_load(1);
+}
+
+TextureCache::~TextureCache() {
+    // Decodes that finished but were never uploaded still own their pixels.
+    DecodeResult result;
+    while (decoded.pop(result)) {
+        stbi_image_free(result.image.pixels);
+    }
+}
+
+TextureCache& TextureCache::instance() {
+    static TextureCache cache;
+    return cache;
+}
+
+std::string TextureCache::normalize(const std::string& path) {
+    std::error_code error;
+    std::filesystem::path absolute = std::filesystem::absolute(path, error);
+    std::string key = (error ? std::filesystem::path(path) : absolute).lexically_normal().generic_string();
+#ifdef _WIN32
+    for (char& c : key) {
+        c = (char)tolower((unsigned char)c);
+    }
+#endif
+    return key;
+}
+
+TextureHandle TextureCache::get(const std::string& path) {
+    std::string key = normalize(path);
+    auto found = by_path.find(key);
+    if (found != by_path.end()) {
+        if (TextureHandle handle = found->second.lock()) {
+            counters.hits++;
+            return handle;
+        }
+    }
+
+    uint64_t content = 0;
+    bool hashed = content_hashing && hash_file(key, content);
+    if (hashed) {
+        auto same = by_content.find(content);
+        if (same != by_content.end()) {
+            if (TextureHandle handle = same->second.lock()) {
+                counters.hits++;
+                by_path[key] = handle;
+                return handle;
+            }
+        }
+    }
+
+    counters.misses++;
+    TextureHandle handle = std::make_shared<TextureResource>();
+    handle->key = key;
+    if (decode_pool) {
+        load_async(handle);
+    }
+    else {
+        load_texture(key, &handle->id, &handle->bytes);
+        counters.bytes_uploaded += handle->bytes;
+    }
+    by_path[key] = handle;
+    if (hashed) {
+        by_content[content] = handle;
+    }
+    if (by_path.size() > 2 * swept_size + 64) {
+        resident_bytes();
+    }
+    return handle;
+}
+
+void TextureCache::load_async(const TextureHandle& handle) {
+    const unsigned char placeholder[3] = { 128, 128, 128 };
+    glGenTextures(1, &handle->id);
+    GLState::instance().edit_texture(handle->id);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 1, 1, 0, GL_RGB, GL_UNSIGNED_BYTE, placeholder);
+
+    counters.pending++;
+    std::weak_ptr<TextureResource> texture = handle;
+    std::string path = handle->key;
+    UploadThread* uploader = upload_thread;
+    decode_pool->submit([this, texture, path, uploader]() {
+        DecodeResult result;
+        result.texture = texture;
+        if (!decode_image(path, result.image)) {
+            std::cout << "ERROR::TEXTURE::LOAD_FAILED" << std::endl;
+        }
+        if (uploader && result.image.pixels) {
+            std::shared_ptr<DecodedImage> image = std::make_shared<DecodedImage>(result.image);
+            std::shared_ptr<unsigned int> id = std::make_shared<unsigned int>(0);
+            size_t bytes = (size_t)image->width * image->height * image->channels;
+            uploader->submit([image, id]() {
+                *id = upload_image_streamed(*image);
+            }, [this, texture, id, bytes]() {
+                finish_streamed(texture, *id, bytes);
+            });
+            return;
+        }
+        decoded.push(std::move(result));
+    });
+}
+
+void TextureCache::finish_streamed(const std::weak_ptr<TextureResource>& texture, unsigned int id, size_t bytes) {
+    counters.pending--;
+    TextureHandle handle = texture.lock();
+    if (!handle) {
+        GLState::instance().delete_texture(id);
+        return;
+    }
+    GLState::instance().delete_texture(handle->id);
+    handle->id = id;
+    handle->bytes = bytes;
+    counters.bytes_uploaded += bytes;
+}
+
+int TextureCache::upload_pending(double budget_seconds) {
+    TRACE_SCOPE("TextureCache::upload_pending");
+    double start = glfwGetTime();
+    int uploaded = 0;
+    DecodeResult result;
+    while (glfwGetTime() - start < budget_seconds && decoded.pop(result)) {
+        counters.pending--;
+        TextureHandle handle = result.texture.lock();
+        if (!handle || result.image.pixels == nullptr) {
+            stbi_image_free(result.image.pixels);
+            continue;
+        }
+        GLState::instance().edit_texture(handle->id);
+        handle->bytes = upload_image(result.image);
+        counters.bytes_uploaded += handle->bytes;
+        uploaded++;
+    }
+    return uploaded;
+}
+
+size_t TextureCache::resident_bytes() {
+    size_t bytes = 0;
+    for (auto entry = by_path.begin(); entry != by_path.end();) {
+        TextureHandle handle = entry->second.lock();
+        if (!handle) {
+            entry = by_path.erase(entry);
+            continue;
+        }
+        // Content aliases share a resource, count it under its own key only.
+        if (handle->key == entry->first) {
+            bytes += handle->bytes;
+        }
+        ++entry;
+    }
+    for (auto entry = by_content.begin(); entry != by_content.end();) {
+        if (entry->second.expired()) {
+            entry = by_content.erase(entry);
+        } else {
+            ++entry;
+        }
+    }
+    swept_size = by_path.size();
+    return bytes;
+}
+
+void TextureCache::print_stats() {
+    std::cout << "TEXTURE_CACHE hits " << counters.hits << ", misses " << counters.misses
+        << ", uploaded " << counters.bytes_uploaded / 1024 << " KB, resident "
+        << resident_bytes() / 1024 << " KB, pending " << counters.pending << std::endl;
+}
+
+void load_texture(const std::string& texture_path, unsigned int *id, size_t* bytes) {
+    TRACE_SCOPE("load_texture");
+    glGenTextures(1, id);
+    GLState::instance().edit_texture(*id);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    size_t size = load_from_image(texture_path);
+    if (bytes) {
+        *bytes = size;
+    }
+    return;
+}
+
+size_t load_from_image(const std::string& texture_path) {
+    TRACE_SCOPE("load_from_image");
+    DecodedImage image;
+    if (!decode_image(texture_path, image)) {
+        std::cout << "ERROR::TEXTURE::LOAD_FAILED" << std::endl;
+        return 0;
+    }
+    return upload_image(image);
+}
+
+bool decode_image(const std::string& texture_path, DecodedImage& image) {
+    TRACE_SCOPE("decode_image");
+    image.pixels = stbi_load(texture_path.c_str(), &image.width, &image.height, &image.channels, 0);
+    if (image.pixels == nullptr) {
+        return false;
+    }
+    if (image.channels >= 3) {
+        return true;
+    }
+    // Grey and grey plus alpha are rare, widen them here instead of probing every file first. stb_image
+    // frees with free() as long as STBI_FREE is not overridden, which this project doesn't do.
+    int channels = image.channels + 2;
+    size_t count = (size_t)image.width * image.height;
+    unsigned char* expanded = (unsigned char*)malloc(count * channels);
+    if (expanded == nullptr) {
+        stbi_image_free(image.pixels);
+        image.pixels = nullptr;
+        return false;
+    }
+    for (size_t i = 0; i < count; i++) {
+        const unsigned char* in = image.pixels + i * image.channels;
+        unsigned char* out = expanded + i * channels;
+        out[0] = out[1] = out[2] = in[0];
+        if (channels == 4) {
+            out[3] = in[1];
+        }
+    }
+    stbi_image_free(image.pixels);
+    image.pixels = expanded;
+    image.channels = channels;
+    return true;
+}
+
+size_t upload_image(DecodedImage& image) {
+    TRACE_SCOPE("upload_image");
+    GLenum format = image.channels == 4 ? GL_RGBA : GL_RGB;
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, format, image.width, image.height, 0, format,
+        GL_UNSIGNED_BYTE, image.pixels);
+    glGenerateMipmap(GL_TEXTURE_2D);
+    stbi_image_free(image.pixels);
+    image.pixels = nullptr;
+    return (size_t)image.width * image.height * image.channels;
+}
+
+unsigned int upload_image_streamed(DecodedImage& image) {
+    TRACE_SCOPE("upload_image_streamed");
+    GLenum format = image.channels == 4 ? GL_RGBA : GL_RGB;
+    size_t size = (size_t)image.width * image.height * image.channels;
+
+    unsigned int pbo;
+    glGenBuffers(1, &pbo);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW);
+    void* mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    if (mapped) {
+        std::memcpy(mapped, image.pixels, size);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    }
+    else {
+        glBufferSubData(GL_PIXEL_UNPACK_BUFFER, 0, size, image.pixels);
+    }
+
+    unsigned int id;
+    glGenTextures(1, &id);
+    glBindTexture(GL_TEXTURE_2D, id);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, format, image.width, image.height, 0, format, GL_UNSIGNED_BYTE, (void*)0);
+    glGenerateMipmap(GL_TEXTURE_2D);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    // The driver keeps the storage alive until the copy into the texture is done.
+    glDeleteBuffers(1, &pbo);
+    stbi_image_free(image.pixels);
+    image.pixels = nullptr;
+    return id;
+}
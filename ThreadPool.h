@@ -0,0 +1,128 @@
+#pragma once
+
+#include <vector>
+#include <queue>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <future>
+#include <functional>
+#include <condition_variable>
+
+#include <Trace.h>
+
+class ThreadPool {
+public:
+    // threads == 0 uses every hardware thread.
+    ThreadPool(unsigned int threads = 0);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    unsigned int size() const { return (unsigned int)workers.size(); }
+
+    template<typename F>
+    auto submit(F task) -> std::future<decltype(task())>;
+
+    // Calls fn(i) for i in [0, count). The calling thread takes part, so this is safe to call from a
+    // task already running on the pool.
+    template<typename F>
+    void parallel_for(size_t count, F fn);
+private:
+    std::vector<std::thread> workers;
+    std::queue<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable condition;
+    bool stopping = false;
+
+    void enqueue(std::function<void()> task);
+};
+
+ThreadPool::ThreadPool(unsigned int threads) {
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (unsigned int i = 0; i < threads; i++) {
+        workers.emplace_back([this]() {
+            TRACE_THREAD_NAME("pool worker");
+            while (true) {
+                std::function<void()> task;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    condition.wait(lock, [this]() { return stopping || !tasks.empty(); });
+                    if (stopping && tasks.empty()) {
+                        return;
+                    }
+                    task = std::move(tasks.front());
+                    tasks.pop();
+                }
+                task();
+            }
+        });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    condition.notify_all();
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+}
+
+void ThreadPool::enqueue(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        tasks.push(std::move(task));
+    }
+    condition.notify_one();
+}
+
+template<typename F>
+auto ThreadPool::submit(F task) -> std::future<decltype(task())> {
+    auto packaged = std::make_shared<std::packaged_task<decltype(task())()>>(std::move(task));
+    std::future<decltype(task())> result = packaged->get_future();
+    enqueue([packaged]() { (*packaged)(); });
+    return result;
+}
+
+template<typename F>
+void ThreadPool::parallel_for(size_t count, F fn) {
+    if (count == 0) {
+        return;
+    }
+    // Helpers may start after the loop is finished, so they only share this state.
+    struct State {
+        std::atomic<size_t> next{ 0 };
+        std::atomic<size_t> done{ 0 };
+        std::mutex mutex;
+        std::condition_variable finished;
+        std::function<void(size_t)> fn;
+    };
+    std::shared_ptr<State> state = std::make_shared<State>();
+    state->fn = fn;
+    auto run = [state, count]() {
+        size_t i;
+        while ((i = state->next++) < count) {
+            state->fn(i);
+            if (++state->done == count) {
+                std::lock_guard<std::mutex> lock(state->mutex);
+                state->finished.notify_all();
+            }
+        }
+    };
+
+    size_t helpers = std::min<size_t>(count - 1, workers.size());
+    for (size_t i = 0; i < helpers; i++) {
+        enqueue(run);
+    }
+    run();
+
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->finished.wait(lock, [&]() { return state->done == count; });
+}
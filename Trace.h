@@ -0,0 +1,229 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+
+// CPU trace markers. TRACE_SCOPE("name") records how long the enclosing block took on the calling
+// thread while a capture is running; without ENABLE_TRACE the macros expand to nothing. A capture of N
+// frames is written as Chrome Trace Event JSON, which chrome://tracing and ui.perfetto.dev both load.
+//
+// Each thread records into its own fixed buffer, so recording takes no lock and never allocates after
+// the thread's first event. The buffer's events are allocated on that first event, threads that only
+// set a name or never record during a capture cost a few bytes. Names must be string literals, only
+// the pointer is stored.
+
+// Events one thread can record per capture, the rest are dropped and counted.
+const size_t TRACE_BUFFER_EVENTS = 1 << 16;
+
+struct TraceEvent {
+    const char* name;
+    uint64_t start_ns;
+    uint64_t duration_ns;
+};
+
+// Written by its thread only. count is published after each event, so the exporter can read up to it
+// while the thread keeps recording. events stays empty until the thread records its first event.
+struct TraceBuffer {
+    std::vector<TraceEvent> events;
+    std::atomic<size_t> count{ 0 };
+    // Capture the events belong to, the owner resets the buffer when a new capture starts.
+    std::atomic<uint32_t> generation{ 0 };
+    std::atomic<size_t> dropped{ 0 };
+    unsigned int thread_id = 0;
+    std::string thread_name;
+};
+
+struct TraceSummary {
+    size_t events = 0;
+    size_t dropped = 0;
+    int frames = 0;
+    double capture_ms = 0.0;
+};
+
+namespace trace {
+    std::atomic<bool> capturing{ false };
+    std::atomic<uint32_t> generation{ 0 };
+    std::mutex registry_mutex;
+    // Buffers live until exit, a thread's events stay readable after it ends.
+    std::vector<std::unique_ptr<TraceBuffer>> registry;
+
+    int frames_left = 0;
+    int frames_captured = 0;
+    uint64_t capture_start_ns = 0;
+    std::string capture_path;
+
+    uint64_t now_ns() {
+        return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    TraceBuffer& thread_buffer() {
+        thread_local TraceBuffer* buffer = nullptr;
+        if (buffer == nullptr) {
+            std::unique_ptr<TraceBuffer> created = std::make_unique<TraceBuffer>();
+            std::lock_guard<std::mutex> lock(registry_mutex);
+            created->thread_id = (unsigned int)registry.size() + 1;
+            buffer = created.get();
+            registry.push_back(std::move(created));
+        }
+        return *buffer;
+    }
+
+    void record(const char* name, uint64_t start_ns, uint64_t end_ns) {
+        TraceBuffer& buffer = thread_buffer();
+        uint32_t current = generation.load(std::memory_order_relaxed);
+        if (buffer.generation.load(std::memory_order_relaxed) != current) {
+            buffer.count.store(0, std::memory_order_relaxed);
+            buffer.dropped.store(0, std::memory_order_relaxed);
+            buffer.generation.store(current, std::memory_order_release);
+        }
+        if (buffer.events.empty()) {
+            // Published to the exporter by the release store of count below.
+            buffer.events.resize(TRACE_BUFFER_EVENTS);
+        }
+        size_t index = buffer.count.load(std::memory_order_relaxed);
+        if (index == buffer.events.size()) {
+            buffer.dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        buffer.events[index] = { name, start_ns, end_ns - start_ns };
+        buffer.count.store(index + 1, std::memory_order_release);
+    }
+
+    void set_thread_name(const char* name) {
+        TraceBuffer& buffer = thread_buffer();
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        buffer.thread_name = name;
+    }
+
+    class Scope {
+    public:
+        Scope(const char* name) {
+            this->name = name;
+            active = capturing.load(std::memory_order_relaxed);
+            if (active) {
+                start_ns = now_ns();
+            }
+        }
+        ~Scope() {
+            if (active) {
+                record(name, start_ns, now_ns());
+            }
+        }
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+    private:
+        const char* name;
+        uint64_t start_ns = 0;
+        bool active;
+    };
+
+    // Starts recording on every thread, the capture is written to path after frames calls to end_frame().
+    void begin_capture(int frames, const std::string& path) {
+        generation.fetch_add(1, std::memory_order_relaxed);
+        frames_left = frames;
+        frames_captured = 0;
+        capture_path = path;
+        capture_start_ns = now_ns();
+        capturing.store(true, std::memory_order_release);
+    }
+
+    // Per-thread events of the current capture, in Chrome's "complete event" form.
+    bool write_json(const std::string& path, TraceSummary& summary) {
+        std::ofstream out(path, std::ofstream::trunc);
+        if (!out) {
+            std::cout << "ERROR::TRACE::OPEN_FAILED " << path << std::endl;
+            return false;
+        }
+        uint32_t current = generation.load(std::memory_order_relaxed);
+        out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+        bool first = true;
+        char line[256];
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        for (const std::unique_ptr<TraceBuffer>& buffer : registry) {
+            if (!buffer->thread_name.empty()) {
+                std::snprintf(line, sizeof(line),
+                    "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+                    first ? "" : ",", buffer->thread_id, buffer->thread_name.c_str());
+                out << line;
+                first = false;
+            }
+            if (buffer->generation.load(std::memory_order_acquire) != current) {
+                continue;
+            }
+            size_t count = buffer->count.load(std::memory_order_acquire);
+            summary.events += count;
+            summary.dropped += buffer->dropped.load(std::memory_order_relaxed);
+            for (size_t i = 0; i < count; i++) {
+                const TraceEvent& event = buffer->events[i];
+                // Scopes opened before the capture started still close inside it.
+                double ts = event.start_ns >= capture_start_ns ? (event.start_ns - capture_start_ns) / 1000.0 : 0.0;
+                std::snprintf(line, sizeof(line),
+                    "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                    first ? "" : ",", event.name, buffer->thread_id, ts, event.duration_ns / 1000.0);
+                out << line;
+                first = false;
+            }
+        }
+        out << "\n]}\n";
+        return (bool)out;
+    }
+
+    // Cost of one recorded scope on this thread, for the overhead estimate. Runs as a throwaway capture
+    // of its own, so call it outside of one.
+    double measure_scope_ns(int iterations) {
+        generation.fetch_add(1, std::memory_order_relaxed);
+        capturing.store(true, std::memory_order_release);
+        uint64_t start = now_ns();
+        for (int i = 0; i < iterations; i++) {
+            Scope scope("trace::measure_scope_ns");
+        }
+        uint64_t elapsed = now_ns() - start;
+        capturing.store(false, std::memory_order_release);
+        return (double)elapsed / iterations;
+    }
+
+    // Counts a frame of the running capture. The capture that ends here is written out, together with
+    // an estimate of what recording cost relative to the frame time.
+    void end_frame() {
+        if (!capturing.load(std::memory_order_relaxed)) {
+            return;
+        }
+        frames_captured++;
+        if (--frames_left > 0) {
+            return;
+        }
+        capturing.store(false, std::memory_order_release);
+        TraceSummary summary;
+        summary.frames = frames_captured;
+        summary.capture_ms = (now_ns() - capture_start_ns) / 1e6;
+        if (!write_json(capture_path, summary)) {
+            return;
+        }
+        // Events of all threads are charged to the render thread's frame, so this errs high.
+        double scope_ns = measure_scope_ns(50000);
+        double frame_ms = summary.capture_ms / summary.frames;
+        double events_per_frame = (double)summary.events / summary.frames;
+        std::cout << "TRACE wrote " << capture_path << ": " << summary.events << " events over " << summary.frames
+            << " frames, " << summary.dropped << " dropped; " << scope_ns << " ns per scope, about "
+            << events_per_frame * scope_ns / (frame_ms * 1e4) << "% of " << frame_ms << " ms frames" << std::endl;
+    }
+}
+
+#ifdef ENABLE_TRACE
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+#define TRACE_SCOPE(name) trace::Scope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+#define TRACE_THREAD_NAME(name) trace::set_thread_name(name)
+#else
+#define TRACE_SCOPE(name) ((void)0)
+#define TRACE_THREAD_NAME(name) ((void)0)
+#endif
@@ -0,0 +1,181 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#include <glm/glm.hpp>
+
+#include <Shader.h>
+
+#include <string>
+#include <cstddef>
+#include <iostream>
+
+// std140 uniform blocks shared by all programs. Each struct mirrors the GLSL block of the same name
+// in shaders/, a vec3 takes 16 bytes unless a scalar follows it, arrays and structs round up to 16.
+// The static_asserts pin every offset to the std140 rules; UniformBuffer::attach checks the size
+// against the linked program as well.
+
+const unsigned int CAMERA_BLOCK_BINDING = 0;
+const unsigned int LIGHTS_BLOCK_BINDING = 1;
+const int MAX_POINT_LIGHTS = 4;
+
+struct CameraBlock {
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::vec3 view_pos;
+    float pad0;
+
+    // The block with its padding zeroed.
+    static CameraBlock make(const glm::mat4& view, const glm::mat4& projection, const glm::vec3& view_pos);
+};
+
+static_assert(offsetof(CameraBlock, view) == 0, "Camera.view");
+static_assert(offsetof(CameraBlock, projection) == 64, "Camera.projection");
+static_assert(offsetof(CameraBlock, view_pos) == 128, "Camera.viewPos");
+static_assert(sizeof(CameraBlock) == 144, "Camera size");
+
+CameraBlock CameraBlock::make(const glm::mat4& view, const glm::mat4& projection, const glm::vec3& view_pos) {
+    CameraBlock block = {};
+    block.view = view;
+    block.projection = projection;
+    block.view_pos = view_pos;
+    return block;
+}
+
+struct DirLightBlock {
+    glm::vec3 direction;
+    float pad0;
+    glm::vec3 ambient;
+    float pad1;
+    glm::vec3 diffuse;
+    float pad2;
+    glm::vec3 specular;
+    float pad3;
+};
+
+static_assert(offsetof(DirLightBlock, ambient) == 16, "DirLight.ambient");
+static_assert(offsetof(DirLightBlock, diffuse) == 32, "DirLight.diffuse");
+static_assert(offsetof(DirLightBlock, specular) == 48, "DirLight.specular");
+static_assert(sizeof(DirLightBlock) == 64, "DirLight size");
+
+struct PointLightBlock {
+    glm::vec3 position;
+    float pad0;
+    glm::vec3 ambient;
+    float pad1;
+    glm::vec3 diffuse;
+    float pad2;
+    glm::vec3 specular;
+    float constant;
+    float linear;
+    float quadratic;
+    float pad3[2];
+};
+
+static_assert(offsetof(PointLightBlock, ambient) == 16, "PointLight.ambient");
+static_assert(offsetof(PointLightBlock, diffuse) == 32, "PointLight.diffuse");
+static_assert(offsetof(PointLightBlock, specular) == 48, "PointLight.specular");
+static_assert(offsetof(PointLightBlock, constant) == 60, "PointLight.constant");
+static_assert(offsetof(PointLightBlock, linear) == 64, "PointLight.linear");
+static_assert(offsetof(PointLightBlock, quadratic) == 68, "PointLight.quadratic");
+static_assert(sizeof(PointLightBlock) == 80, "PointLight size");
+
+struct FlashLightBlock {
+    glm::vec3 position;
+    float pad0;
+    glm::vec3 direction;
+    float pad1;
+    glm::vec3 ambient;
+    float pad2;
+    glm::vec3 diffuse;
+    float pad3;
+    glm::vec3 specular;
+    float cut_off;
+    float outer_cut_off;
+    float constant;
+    float linear;
+    float quadratic;
+};
+
+static_assert(offsetof(FlashLightBlock, direction) == 16, "FlashLight.direction");
+static_assert(offsetof(FlashLightBlock, ambient) == 32, "FlashLight.ambient");
+static_assert(offsetof(FlashLightBlock, diffuse) == 48, "FlashLight.diffuse");
+static_assert(offsetof(FlashLightBlock, specular) == 64, "FlashLight.specular");
+static_assert(offsetof(FlashLightBlock, cut_off) == 76, "FlashLight.cutOff");
+static_assert(offsetof(FlashLightBlock, outer_cut_off) == 80, "FlashLight.outerCutOff");
+static_assert(offsetof(FlashLightBlock, constant) == 84, "FlashLight.constant");
+static_assert(offsetof(FlashLightBlock, linear) == 88, "FlashLight.linear");
+static_assert(offsetof(FlashLightBlock, quadratic) == 92, "FlashLight.quadratic");
+static_assert(sizeof(FlashLightBlock) == 96, "FlashLight size");
+
+struct LightsBlock {
+    DirLightBlock dir_light;
+    PointLightBlock point_lights[MAX_POINT_LIGHTS];
+    FlashLightBlock flash_light;
+};
+
+static_assert(offsetof(LightsBlock, point_lights) == 64, "Lights.pointLights");
+static_assert(offsetof(LightsBlock, flash_light) == 64 + 80 * MAX_POINT_LIGHTS, "Lights.flashLight");
+static_assert(sizeof(LightsBlock) == 64 + 80 * MAX_POINT_LIGHTS + 96, "Lights size");
+
+// Buffer behind one block, bound to its binding point for as long as it lives.
+template<typename T>
+class UniformBuffer {
+public:
+    UniformBuffer(const std::string& block_name, unsigned int binding);
+    ~UniformBuffer();
+    UniformBuffer(const UniformBuffer&) = delete;
+    UniformBuffer& operator=(const UniformBuffer&) = delete;
+
+    // Points the program's block at this buffer's binding. Programs without the block are left alone.
+    bool attach(const Shader& shader) const;
+    // One write of the whole block.
+    void update(const T& data);
+private:
+    std::string block_name;
+    unsigned int binding;
+    unsigned int buffer = 0;
+};
+
+template<typename T>
+UniformBuffer<T>::UniformBuffer(const std::string& block_name, unsigned int binding) {
+    this->block_name = block_name;
+    this->binding = binding;
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(T), nullptr, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    glBindBufferBase(GL_UNIFORM_BUFFER, binding, buffer);
+}
+
+template<typename T>
+UniformBuffer<T>::~UniformBuffer() {
+    if (buffer != 0 && glfwGetCurrentContext() != nullptr) {
+        glDeleteBuffers(1, &buffer);
+    }
+}
+
+template<typename T>
+bool UniformBuffer<T>::attach(const Shader& shader) const {
+    unsigned int index = glGetUniformBlockIndex(shader.ID, block_name.c_str());
+    if (index == GL_INVALID_INDEX) {
+        return false;
+    }
+    int size = 0;
+    glGetActiveUniformBlockiv(shader.ID, index, GL_UNIFORM_BLOCK_DATA_SIZE, &size);
+    // Drivers may leave off the padding after the last member, so the buffer only has to cover the block.
+    if (size > (int)sizeof(T)) {
+        std::cout << "ERROR::UNIFORM_BLOCK::SIZE_MISMATCH " << block_name << " " << size << " > "
+            << sizeof(T) << std::endl;
+        return false;
+    }
+    glUniformBlockBinding(shader.ID, index, binding);
+    return true;
+}
+
+template<typename T>
+void UniformBuffer<T>::update(const T& data) {
+    glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(T), &data);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
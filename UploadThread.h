@@ -0,0 +1,196 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+#include <MpscQueue.h>
+#include <Trace.h>
+
+#include <queue>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <cstring>
+#include <iostream>
+#include <functional>
+#include <condition_variable>
+
+// Thread owning a hidden GL context that shares objects with the render context. Jobs run there and
+// are followed by a fence; once the GPU has passed it, poll() on the render thread runs the job's
+// done callback, so the render thread never uses an object that is still being filled.
+//
+// Only buffers, textures and syncs are shared between contexts. Container objects such as VAOs have
+// to be created in the done callback.
+class UploadThread {
+public:
+    // Call on the main thread, GLFW only creates windows there.
+    UploadThread(GLFWwindow* shared);
+    ~UploadThread();
+    UploadThread(const UploadThread&) = delete;
+    UploadThread& operator=(const UploadThread&) = delete;
+
+    bool is_running() const { return context != nullptr; }
+    // Thread safe.
+    void submit(std::function<void()> job, std::function<void()> done);
+    // Render thread: runs callbacks of jobs whose fence has signalled, never waits. Returns how many ran.
+    int poll();
+    // Jobs submitted whose done callback has not run yet, queued ones included.
+    size_t in_flight() const { return outstanding.load(); }
+private:
+    struct Job {
+        std::function<void()> work;
+        std::function<void()> done;
+    };
+
+    struct Finished {
+        GLsync fence = nullptr;
+        std::function<void()> done;
+    };
+
+    GLFWwindow* context = nullptr;
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::queue<Job> jobs;
+    bool stopping = false;
+    MpscQueue<Finished> finished;
+    std::vector<Finished> waiting;
+    std::atomic<size_t> outstanding{ 0 };
+
+    void run();
+    void run_done(Finished& result);
+};
+
+// Creates a GL_STATIC_DRAW buffer and fills it through a mapping, the driver can then copy
+// asynchronously instead of stalling in glBufferData. Buffers are untyped, it can be bound to any target later.
+unsigned int stream_buffer(const void* data, size_t size);
+
+UploadThread::UploadThread(GLFWwindow* shared) {
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 4);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    context = glfwCreateWindow(1, 1, "upload", nullptr, shared);
+    glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+    if (context == nullptr) {
+        std::cout << "ERROR::UPLOAD_THREAD::FAILED_TO_CREATE_CONTEXT" << std::endl;
+        return;
+    }
+    worker = std::thread(&UploadThread::run, this);
+}
+
+// The worker finishes every queued job before it stops. Their done callbacks then run here, after
+// waiting on the fences, so the buffers and textures the jobs created are handed to their owners and
+// deleted with them rather than leaked. Without a current context they can only be dropped.
+UploadThread::~UploadThread() {
+    if (context == nullptr) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    condition.notify_all();
+    worker.join();
+
+    Finished done;
+    while (finished.pop(done)) {
+        waiting.push_back(std::move(done));
+    }
+    bool current = glfwGetCurrentContext() != nullptr;
+    for (Finished& pending : waiting) {
+        if (current) {
+            glClientWaitSync(pending.fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+            run_done(pending);
+        }
+        else {
+            glDeleteSync(pending.fence);
+        }
+    }
+    waiting.clear();
+    glfwDestroyWindow(context);
+}
+
+void UploadThread::submit(std::function<void()> job, std::function<void()> done) {
+    outstanding++;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        jobs.push({ std::move(job), std::move(done) });
+    }
+    condition.notify_one();
+}
+
+void UploadThread::run() {
+    TRACE_THREAD_NAME("upload");
+    glfwMakeContextCurrent(context);
+    while (true) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            condition.wait(lock, [this]() { return stopping || !jobs.empty(); });
+            if (stopping && jobs.empty()) {
+                break;
+            }
+            job = std::move(jobs.front());
+            jobs.pop();
+        }
+        job.work();
+
+        Finished result;
+        result.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        result.done = std::move(job.done);
+        // Without a flush the fence might never reach the GPU and the render thread would wait forever.
+        glFlush();
+        finished.push(std::move(result));
+    }
+    glfwMakeContextCurrent(nullptr);
+}
+
+int UploadThread::poll() {
+    Finished result;
+    while (finished.pop(result)) {
+        waiting.push_back(std::move(result));
+    }
+
+    int ran = 0;
+    // Fences signal in submission order, stop at the first one still pending.
+    size_t i = 0;
+    for (; i < waiting.size(); i++) {
+        GLenum status = glClientWaitSync(waiting[i].fence, 0, 0);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+            break;
+        }
+        run_done(waiting[i]);
+        ran++;
+    }
+    waiting.erase(waiting.begin(), waiting.begin() + i);
+    return ran;
+}
+
+void UploadThread::run_done(Finished& result) {
+    glDeleteSync(result.fence);
+    if (result.done) {
+        result.done();
+    }
+    outstanding--;
+}
+
+unsigned int stream_buffer(const void* data, size_t size) {
+    unsigned int buffer;
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    glBufferData(GL_COPY_WRITE_BUFFER, size, nullptr, GL_STATIC_DRAW);
+    if (size > 0) {
+        void* mapped = glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        if (mapped) {
+            std::memcpy(mapped, data, size);
+            glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+        }
+        else {
+            glBufferSubData(GL_COPY_WRITE_BUFFER, 0, size, data);
+        }
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    return buffer;
+}
@@ -1,10 +1,92 @@
 #include <Renderer.h>
+#include <Benchmark.h>
+
+#include <cstdlib>
 
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
 
-int main() {
+int main(int argc, char** argv) {
+    std::string mode = argc > 1 ? argv[1] : "";
+    std::vector<std::string> paths(argv + (argc > 1 ? 2 : 1), argv + argc);
+    if (paths.empty()) {
+        paths = { "models/cube/cube.obj", "models/backpack/backpack.obj", "models/orc/orc2.obj" };
+    }
+    if (mode == "--bench-obj") {
+        return bench_obj_loader(paths, 5);
+    }
+    if (mode == "--bench-obj-threads") {
+        return bench_obj_scaling(paths, 5);
+    }
+    if (mode == "--bench-mesh-cache") {
+        if (argc <= 2) {
+            paths = { "models/backpack/backpack.obj" };
+        }
+        return bench_mesh_cache(paths);
+    }
+    if (mode == "--bench-model-import") {
+        if (argc <= 2) {
+            paths = { "models/backpack/backpack.obj", "models/cube/cube.obj" };
+        }
+        return bench_model_import(paths, 16);
+    }
+    if (mode == "--bench-upload") {
+        return bench_upload(argc > 2 ? paths[0] : "models/backpack/backpack.obj", 300);
+    }
+    if (mode == "--bench-draw") {
+        return bench_draw(argc > 2 ? paths[0] : "models/backpack/backpack.obj", 200, 100);
+    }
+    if (mode == "--bench-instancing") {
+        return bench_instancing(argc > 2 ? paths[0] : "models/cube/cube.obj", 20);
+    }
+    if (mode == "--bench-uniforms") {
+        return bench_uniforms(1000000);
+    }
+    if (mode == "--bench-program-cache") {
+        return bench_program_cache();
+    }
+    if (mode == "--bench-shader-compile") {
+        return bench_shader_compile();
+    }
+    if (mode == "--bench-trace") {
+        return bench_trace(1000000);
+    }
+    if (mode == "--bench-culling") {
+        return bench_culling(1000000, 20);
+    }
+    if (mode == "--bench-occlusion") {
+        return bench_occlusion(100000, 100);
+    }
+    if (mode == "--bench-bvh") {
+        return bench_bvh(argc > 2 ? (size_t)std::atoll(argv[2]) : 100000, 1000);
+    }
+
     Renderer engine(1920, 1080, "opengl");
+    // --bench-headless[-osmesa] [frames] [report.json] [baseline.json] [camera path]
+    if (mode == "--bench-headless" || mode == "--bench-headless-osmesa") {
+        engine.set_headless(mode == "--bench-headless" ? GLFW_EGL_CONTEXT_API : GLFW_OSMESA_CONTEXT_API);
+        engine.set_benchmark(argc > 2 ? std::atoi(argv[2]) : 600, argc > 3 ? argv[3] : "bench_headless.json",
+            argc > 4 ? argv[4] : nullptr, argc > 5 ? argv[5] : nullptr);
+    }
+    if (mode == "--bench-window") {
+        engine.set_benchmark(argc > 2 ? std::atoi(argv[2]) : 600, argc > 3 ? argv[3] : "bench_window.json",
+            argc > 4 ? argv[4] : nullptr, argc > 5 ? argv[5] : nullptr);
+    }
+    if (mode == "--frame-csv") {
+        engine.set_frame_csv(argc > 2 ? argv[2] : "frame_times.csv");
+    }
+    if (mode == "--trace") {
+        engine.set_trace_frames(argc > 2 ? std::atoi(argv[2]) : 300);
+    }
+    if (mode == "--occlusion-culling") {
+        engine.set_occlusion_culling(true);
+    }
+    if (mode == "--gpu-occlusion") {
+        engine.set_gpu_occlusion(true);
+    }
+    if (mode == "--gpu-profile-draws") {
+        GpuProfiler::instance().set_per_draw(true);
+    }
 
     int err = engine.setup();
     if (err != 0) {
@@ -13,5 +95,5 @@ int main() {
     }
     engine.render_loop();
 
-    return 0;
-}
\ No newline at end of file
+    return engine.get_exit_code();
+}
@@ -1,14 +1,31 @@
 #version 330 core
 
+// Defaults, ShaderVariants injects the counts each material and scene actually use.
+#ifndef NUM_DIFFUSE
 #define NUM_DIFFUSE 3
+#endif
+#ifndef NUM_SPECULAR
 #define NUM_SPECULAR 3
+#endif
+#ifndef NUM_EMISSION
 #define NUM_EMISSION 3
+#endif
+#ifndef NUM_POINT_LIGHT
 #define NUM_POINT_LIGHT 4
+#endif
+// Size of the Lights block, fixed so every variant shares one layout.
+#define MAX_POINT_LIGHTS 4
 
 struct Material {
+#if NUM_DIFFUSE > 0
 	sampler2D diffuse[NUM_DIFFUSE];
+#endif
+#if NUM_SPECULAR > 0
 	sampler2D specular[NUM_SPECULAR];
+#endif
+#if NUM_EMISSION > 0
 	sampler2D emission[NUM_EMISSION];
+#endif
 	float shininess;
 };
 
@@ -50,10 +67,19 @@ in vec3 FragPos;
 in vec3 Normal;
 
 uniform Material material;
-uniform DirLight dirLight;
-uniform PointLight pointLights[NUM_POINT_LIGHT];
-uniform FlashLight flashLight;
-uniform vec3 viewPos;
+
+// Layouts mirrored by CameraBlock and LightsBlock in UniformBlocks.h.
+layout (std140) uniform Camera {
+	mat4 view;
+	mat4 projection;
+	vec3 viewPos;
+};
+
+layout (std140) uniform Lights {
+	DirLight dirLight;
+	PointLight pointLights[MAX_POINT_LIGHTS];
+	FlashLight flashLight;
+};
 
 out vec4 FragColor;
 
@@ -82,10 +108,12 @@ void main(){
 	vec3 normal = normalize(Normal);
 	vec3 viewVec = FragPos - viewPos; // towards fragment - not normalized
 
+#if NUM_POINT_LIGHT > 0
 	for(int i = 0; i < NUM_POINT_LIGHT; i++) {
 		result += calc_point_light(pointLights[i], mTex, viewVec, normal);
 	}
 	result /= NUM_POINT_LIGHT;
+#endif
 
 	result += calc_dir_light(dirLight, mTex, viewVec, normal);
 
@@ -165,22 +193,27 @@ vec3 calc_flash_light(FlashLight flashLight, MaterialTex mTex,
 
 vec3 sum_diffuse() {
 	vec4 result = vec4(0.0);
+#if NUM_DIFFUSE > 0
 	for(int i = 0; i < NUM_DIFFUSE; i++) {
 		result += texture(material.diffuse[i], TexCoords);
 	}
+#endif
 	return vec3(result);
 }
 
 vec3 sum_specular() {
 	vec4 result = vec4(0.0);
+#if NUM_SPECULAR > 0
 	for(int i = 0; i < NUM_SPECULAR; i++) {
 		result += texture(material.specular[i], TexCoords);
 	}
+#endif
 	return vec3(result);
 }
 
 vec3 sum_emission() {
 	vec4 result = vec4(0.0);
+#if NUM_EMISSION > 0
 	for(int i = 0; i < NUM_EMISSION; i++) {
 		result += texture(material.emission[i], TexCoords);
 	}
@@ -189,6 +222,7 @@ vec3 sum_emission() {
 	float attenuation = 1 / (1.0 + distance * 0.14 + distance * distance * 0.07);
 
 	result *= attenuation / NUM_EMISSION;
+#endif
 
 	return vec3(result);
 }
\ No newline at end of file
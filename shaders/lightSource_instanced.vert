@@ -0,0 +1,19 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aNormal;
+layout (location = 2) in vec2 aTexCoords;
+layout (location = 3) in mat4 aModel;
+layout (location = 7) in vec3 aColor;
+
+layout (std140) uniform Camera {
+    mat4 view;
+    mat4 projection;
+    vec3 viewPos;
+};
+
+out vec4 Color;
+
+void main() {
+    gl_Position = projection * view * aModel * vec4(aPos, 1.0);
+    Color = vec4(aColor, 1.0);
+}
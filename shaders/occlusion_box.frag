@@ -0,0 +1,8 @@
+#version 330 core
+
+out vec4 FragColor;
+
+// Color writes are masked off while boxes are drawn, only the sample count matters.
+void main() {
+    FragColor = vec4(1.0);
+}
\ No newline at end of file
@@ -0,0 +1,15 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+
+// Maps the unit cube onto the tested bounding box.
+uniform mat4 box;
+
+layout (std140) uniform Camera {
+    mat4 view;
+    mat4 projection;
+    vec3 viewPos;
+};
+
+void main() {
+    gl_Position = projection * view * box * vec4(aPos, 1.0);
+}
\ No newline at end of file